@@ -0,0 +1,264 @@
+/**
+ * Microbenchmarks for the offline DSP kernels, run on synthetic
+ * waveforms (baseline, gaussian noise and an exponential tail
+ * pulse) at the record lengths and peaking times we use. The
+ * waveforms come from a fixed seed, and every benchmark reports
+ * the fastest of a number of repetitions, so the numbers are
+ * comparable between builds. The decoding of the DPP-PHA readout
+ * runs on the same waveforms, encoded as the board sends them.
+ *
+ * usage: dactylos_bench [--waveforms N] [--repeat R] [--threads T] [--seed S]
+ */
+
+#include <iostream>
+#include <iomanip>
+#include <string>
+#include <vector>
+#include <random>
+#include <chrono>
+#include <cmath>
+#include <cstring>
+#include <cstdlib>
+#include <algorithm>
+#include <stdexcept>
+
+#include "trapezoidal_shaper.h"
+#include "baseline.h"
+#include "trigger_finder.h"
+#include "dpp_decoder.hh"
+
+// record lengths (samples) and peaking times (ns)
+static const std::vector<size_t> RECORDLENGTHS = {10000, 25000, 50000, 100000};
+static const std::vector<int> PEAKINGTIMES     = {1000, 4000, 10000, 30000};
+
+/*********************************************************************/
+
+struct Options
+{
+    size_t nwaveforms = 128;
+    int repeat        = 5;
+    int nthreads      = 1;
+    unsigned seed     = 20200604;
+};
+
+/*********************************************************************/
+
+static Options parse_options_(int argc, char* argv[]) {
+  Options opt;
+  for (int k=1; k<argc; k++)
+    {
+      std::string arg(argv[k]);
+      if (arg == "--help")
+        {
+          std::cout << "usage: " << argv[0]
+                    << " [--waveforms N] [--repeat R] [--threads T] [--seed S]" << std::endl;
+          std::exit(0);
+        }
+      if (k + 1 >= argc)
+        throw std::runtime_error("Missing value for " + arg);
+      long value = std::atol(argv[++k]);
+      if (arg == "--waveforms")    opt.nwaveforms = std::max(1L, value);
+      else if (arg == "--repeat")  opt.repeat     = std::max(1L, value);
+      else if (arg == "--threads") opt.nthreads   = std::max(0L, value);
+      else if (arg == "--seed")    opt.seed       = value;
+      else throw std::runtime_error("Unknown option " + arg);
+    }
+  return opt;
+};
+
+/*********************************************************************/
+
+// baseline of 1000 adc counts with 5 counts of noise, and a pulse
+// with 100 ns rise time and 80 us decay time at 20% of the record
+static std::vector<int16_t> make_waveforms_(size_t nwaveforms, size_t nsamples, unsigned seed) {
+  std::mt19937 rng(seed);
+  std::normal_distribution<float> noise(0, 5);
+  std::uniform_real_distribution<float> amplitude(200, 4000);
+  std::vector<int16_t> data(nwaveforms*nsamples);
+  size_t t0 = nsamples/5;
+  for (size_t k=0; k<nwaveforms; k++)
+    {
+      float a = amplitude(rng);
+      int16_t* waveform = data.data() + k*nsamples;
+      for (size_t i=0; i<nsamples; i++)
+        {
+          float x = 1000 + noise(rng);
+          if (i >= t0)
+            {
+              float t = (float)(i - t0);
+              x += a*(1 - std::exp(-t/25.f))*std::exp(-t/20000.f);
+            }
+          waveform[i] = (int16_t)std::lround(x);
+        }
+    }
+  return data;
+};
+
+/*********************************************************************/
+
+// fastest of repeat runs in seconds, after one warm up run
+template<typename F>
+static double time_it_(F func, int repeat) {
+  func();
+  double best = 1e300;
+  for (int r=0; r<repeat; r++)
+    {
+      auto start = std::chrono::steady_clock::now();
+      func();
+      auto stop  = std::chrono::steady_clock::now();
+      best = std::min(best, std::chrono::duration<double>(stop - start).count());
+    }
+  return best;
+};
+
+/*********************************************************************/
+
+static void report_(std::string const &name, std::string const &setting, size_t nsamples,
+                    size_t nwaveforms, double seconds) {
+  double ns_per_waveform = 1e9*seconds/nwaveforms;
+  double msamples_per_s  = 1e-6*nsamples*nwaveforms/seconds;
+  std::cout << std::left  << std::setw(28) << name
+            << std::setw(22) << setting
+            << std::right << std::setw(10) << nsamples
+            << std::fixed << std::setprecision(1)
+            << std::setw(16) << ns_per_waveform
+            << std::setw(14) << msamples_per_s << std::endl;
+};
+
+/*********************************************************************/
+
+// stand-in for the CAEN library, so the decoding of the readout can be
+// timed without a board. The encoded waveform has two samples per word,
+// 14 bits of adc with the digital probe in bit 14 and the trigger in
+// bit 15 of each half, as the board sends it. Format holds the number
+// of samples here
+extern "C" CAEN_DGTZ_ErrorCode CAENDGTZ_API CAEN_DGTZ_DecodeDPPWaveforms(int, void *event, void *waveforms)
+{
+  CAEN_DGTZ_DPP_PHA_Event_t* ev    = (CAEN_DGTZ_DPP_PHA_Event_t*)event;
+  CAEN_DGTZ_DPP_PHA_Waveforms_t* wf = (CAEN_DGTZ_DPP_PHA_Waveforms_t*)waveforms;
+  wf->Ns = ev->Format;
+  for (uint32_t k=0; k<wf->Ns; k++)
+    {
+      uint32_t half = ev->Waveforms[k/2] >> (16*(k%2));
+      wf->Trace1[k]  = half & 0x3fff;
+      wf->DTrace1[k] = (half >> 14) & 1;
+      wf->DTrace2[k] = (half >> 15) & 1;
+    }
+  return CAEN_DGTZ_Success;
+};
+
+/*********************************************************************/
+
+// encode the waveforms as above, one event per waveform, with the
+// trigger from the beginning of the pulse on
+static std::vector<uint32_t> encode_waveforms_(const int16_t* data, size_t nwaveforms, size_t nsamples) {
+  size_t nwords = (nsamples + 1)/2;
+  std::vector<uint32_t> encoded(nwaveforms*nwords, 0);
+  for (size_t k=0; k<nwaveforms; k++)
+    {
+      for (size_t i=0; i<nsamples; i++)
+        {
+          uint32_t half = (data[k*nsamples + i] & 0x3fff) | ((i >= nsamples/5) ? (1 << 15) : 0);
+          encoded[k*nwords + i/2] |= half << (16*(i%2));
+        }
+    }
+  return encoded;
+};
+
+/*********************************************************************/
+
+int main(int argc, char* argv[]) {
+  Options opt;
+  try
+    {opt = parse_options_(argc, argv);}
+  catch (std::exception const &e)
+    {
+      std::cerr << e.what() << std::endl;
+      return 1;
+    }
+
+  std::cout << "dactylos_bench - " << opt.nwaveforms << " waveforms, best of " << opt.repeat
+            << " runs, " << opt.nthreads << " thread(s) (0 : one per core), seed " << opt.seed << std::endl;
+  std::cout << "trapezoid kernel : " << TrapezoidalFilter::get_kernel_name() << std::endl << std::endl;
+  std::cout << std::left  << std::setw(28) << "benchmark"
+            << std::setw(22) << "setting"
+            << std::right << std::setw(10) << "samples"
+            << std::setw(16) << "ns/waveform"
+            << std::setw(14) << "Msamples/s" << std::endl;
+
+  size_t nw = opt.nwaveforms;
+  std::vector<float> energies(nw*PEAKINGTIMES.size());
+  std::vector<uint32_t> triggers(nw);
+  for (auto nsamples : RECORDLENGTHS)
+    {
+      std::vector<int16_t> data = make_waveforms_(nw, nsamples, opt.seed);
+      const int16_t* d = data.data();
+
+      // only the peaking times for which the trapezoid fits into
+      // the record, the others return right away
+      std::vector<int> ptimes;
+      for (auto ptime : PEAKINGTIMES)
+        {
+          if ((size_t)(2*ptime + 1000)/4 < nsamples)
+            {ptimes.push_back(ptime);}
+        }
+
+      for (auto ptime : ptimes)
+        {
+          TrapezoidalFilter trapezoid(ptime, 1000, nsamples);
+          double t = time_it_([&]() {trapezoid.shape_batch(d, nw, nsamples, energies.data(), opt.nthreads);},
+                              opt.repeat);
+          report_("trapezoid", "ptime " + std::to_string(ptime), nsamples, nw, t);
+        }
+
+      PoleZeroTrapezoidalFilter pz(4000, 1000, 80000);
+      double t = time_it_([&]() {pz.shape_batch(d, nw, nsamples, energies.data(), opt.nthreads);}, opt.repeat);
+      report_("pole-zero trapezoid", "ptime 4000", nsamples, nw, t);
+
+      for (auto mode : {BaselineMode::Mean, BaselineMode::Median, BaselineMode::TruncatedMean})
+        {
+          const char* names[] = {"mean", "median", "truncated mean"};
+          t = time_it_([&]() {
+            for (size_t k=0; k<nw; k++)
+              {energies[k] = estimate_baseline(d + k*nsamples, nsamples, 1000, mode);}
+          }, opt.repeat);
+          report_("baseline", names[(int)mode], nsamples, nw, t);
+        }
+
+      for (auto mode : {TriggerMode::LeadingEdge, TriggerMode::FastFilter, TriggerMode::CFD})
+        {
+          const char* names[] = {"leading edge", "rc-cr2", "cfd"};
+          TriggerFinder finder(mode);
+          t = time_it_([&]() {finder.find_triggers(d, nw, nsamples, triggers.data(), opt.nthreads);},
+                       opt.repeat);
+          report_("trigger", names[(int)mode], nsamples, nw, t);
+        }
+
+      // one channel with one event per waveform, decoded by the
+      // same function as in the decode stage of continuous_readout
+      std::vector<uint32_t> encoded = encode_waveforms_(d, nw, nsamples);
+      std::vector<CAEN_DGTZ_DPP_PHA_Event_t> events(nw);
+      for (size_t k=0; k<nw; k++)
+        {
+          events[k].Format    = nsamples;
+          events[k].Energy    = 1000;
+          events[k].Waveforms = encoded.data() + k*((nsamples + 1)/2);
+        }
+      std::vector<int16_t> trace1(nsamples);
+      std::vector<uint8_t> dtrace1(nsamples), dtrace2(nsamples);
+      CAEN_DGTZ_DPP_PHA_Waveforms_t waveform = {};
+      waveform.Trace1  = trace1.data();
+      waveform.DTrace1 = dtrace1.data();
+      waveform.DTrace2 = dtrace2.data();
+      ReadoutBuffer_t raw = {};
+      raw.events[0]     = events.data();
+      raw.num_events[0] = nw;
+      raw.waveform      = &waveform;
+      DecodedBlock_t block;
+      t = time_it_([&]() {decode_readout_buffer(0, &raw, &block, 1, true);}, opt.repeat);
+      report_("decode", "dpp-pha trace1", nsamples, nw, t);
+      std::cout << std::endl;
+    }
+  return 0;
+};
+
@@ -222,6 +222,14 @@ class CaenN6725(object):
         self.logger.debug("Will calibrate the digitizer")
         self.digitizer.calibrate()
         self.digitizer.allocate_memory()
+        if self.has_dpp_pha_firmware:
+            # how to wait for data, "poll", "backoff" (default) or "irq"
+            policies = {"poll"    : _cn.WaitPolicy.Poll,\
+                        "backoff" : _cn.WaitPolicy.Backoff,\
+                        "irq"     : _cn.WaitPolicy.IRQ}
+            policy = config.get('wait-policy', 'backoff')
+            assert policy in policies, f"The wait policy has to be one of {list(policies.keys())}!"
+            self.digitizer.set_wait_policy(policies[policy])
         self.logger.info("Digitizer set up!")
         return 
 
@@ -408,6 +416,9 @@ class CaenN6725(object):
             self.digitizer.readout_and_save(seconds)
         else:
             self.digitizer.continuous_readout(seconds)
+            for stats in self.digitizer.get_pipeline_stats():
+                self.logger.debug(stats)
+            self.logger.debug(self.digitizer.get_wait_stats())
         self.digitizer.end_acquisition()
         self.logger.info(f"We saw {self.digitizer.get_n_events_tot()} events!")
         return
@@ -433,7 +444,9 @@ class CaenN6725(object):
         last = time.monotonic()
         while delta_t <= seconds:
             if self.has_dpp_pha_firmware:
-                events = self.digitizer.read_data(fill_histogram)
+                # only the waveforms are shown, the events
+                # do not need to become python objects
+                self.digitizer.read_data_array(fill_histogram)
                 events = []
                 for ch in range(8):
                     events.append(self.digitizer.get_last_waveform(ch))
@@ -531,7 +544,7 @@ class CaenN6725(object):
         data = []
         while len(data) == 0:
             data = self.digitizer.read_data(0)
-            if sum(self.digitizer.get_digital_trace2()) < 1:
+            if not np.any(self.digitizer.get_digital_trace2()):
                 data = []
 
         self.digitizer.end_acquisition()
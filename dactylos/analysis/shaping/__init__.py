@@ -1,6 +1,7 @@
 
 
 from .gauss_shaper import GaussShaper
+from .gauss_shaper import HAS_NATIVE_SHAPER
 
 USE_CXX_EXTENSION=True
 
@@ -15,3 +16,11 @@ else:
     from .trapezoidal_shaper import TrapezoidalFilter
     print (f"WARNING, not using c++  extension for TrapezoidalFilter, Trapezoidal filter will be SLOW!.")
 
+# the noise scan over peaking times, the tile scheduler
+# and the noise spectrum only exist natively
+try:
+    from dactylos._pyCaenN6725 import ENCScanner
+    from dactylos._pyCaenN6725 import TileScheduler, ShaperSetting, ShaperKind
+    from dactylos._pyCaenN6725 import NoisePSD
+except ImportError:
+    pass
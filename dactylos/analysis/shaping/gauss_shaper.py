@@ -2,31 +2,81 @@
 Gaussian shaper class primarily for the use with 
 dactyos data.
 """
+import numpy as np
+
 from scipy.signal import sosfilt
 
 from .shapers import shaper
 
+try:
+    from dactylos._pyCaenN6725 import GaussianShaper as _GaussianShaper
+except ImportError as e:
+    print (f"WARNING, can not import c++  extension for GaussianShaper, Gaussian shaper will be SLOW!. Exception {e}")
+    _GaussianShaper = None
+
+# the native shaper subtracts the baseline itself
+HAS_NATIVE_SHAPER = _GaussianShaper is not None
+
 class GaussShaper(object):
     """
     A wrapper for Alex shaper software.
 
     """
     def __init__(self, peaktime, order=4,\
-                 dt=4e-9, decay_time=80e-6):
+                 dt=4e-9, decay_time=80e-6,\
+                 nbaseline=1000):
         """
         
         Args:
             peaktime (float)  : peaking time in nanosecondd
 
+        Keyword Args:
+            nbaseline (int)   : number of samples at the beginning of the
+                                waveform used for the baseline, which is subtracted
+                                before shaping. 0 for baseline corrected waveforms
+        """
+        self.nbaseline = nbaseline
+        if _GaussianShaper is not None:
+            # the c++ shaper computes the same filter, but
+            # wants everything in nanoseconds
+            self._shaper = _GaussianShaper(peaktime, order, 1e9*dt, 1e9*decay_time, nbaseline)
+            self.sos = self._shaper.get_sos()
+            # whole blocks of waveforms in native threads
+            self.shape_batch = self._shaper.shape_batch
+            # full shaped traces of a block, optionally into 
+            # a preallocated (nwaveforms x nsamples) float32 array
+            self.shape_traces = self._shaper.shape_traces
+        else:
+            self._shaper = None
+            # remember to convert everything to seconds
+            self.sos = shaper("gaussian",order,1e-9*peaktime,dt=dt,pz=1./decay_time)
+
+    def _is_native_input(self, tailpulses):
+        """
+        The native shaper takes the raw int16 samples, anything else
+        (e.g. float baseline corrected waveforms) goes through scipy
+        """
+        return (self._shaper is not None) and np.issubdtype(tailpulses.dtype, np.integer)
+
+    def _sosfilt(self, tailpulses):
+        """
+        The scipy version of the native shaper, including the baseline
         """
-        # remember to convert everything to seconds
-        self.sos = shaper("gaussian",order,1e-9*peaktime,dt=dt,pz=1./decay_time)
+        if self.nbaseline > 0:
+            tailpulses = tailpulses - tailpulses[:self.nbaseline].mean()
+        return sosfilt(self.sos,tailpulses)
 
     def shape_it(self, tailpulses):
-        y = sosfilt(self.sos,tailpulses)
+        tailpulses = np.asarray(tailpulses)
+        if self._is_native_input(tailpulses):
+            return self._shaper.shape_it(tailpulses)
+        y = self._sosfilt(tailpulses)
         return max(y)
 
     def get_shaped_wf(self, tailpulses):
-        y = sosfilt(self.sos,tailpulses)
+        tailpulses = np.asarray(tailpulses)
+        if self._is_native_input(tailpulses):
+            return self._shaper.shape_traces(tailpulses[np.newaxis,:])[0]
+        y = self._sosfilt(tailpulses)
         return y 
 
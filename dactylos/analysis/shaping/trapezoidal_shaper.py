@@ -18,19 +18,32 @@ class TrapezoidalFilter(object):
     def __init__(self,\
                  ptime = 1000,\
                  flat  = 1000,
-                 recordlength = 50000):
+                 recordlength = 50000,
+                 sample_period = 4,
+                 decimation = 1):
         """
         Keyword Args:
             ptime  (float)         :
             flat   (float)         :
             recordlength (int)     : waveform recordlength for preparing of the shaper windows
+            sample_period (float)  : sample period in ns, 4 for the N6725, 8 in dual trace mode
+            decimation (int)       : average blocks of this many samples before shaping
         """
+        if sample_period <= 0:
+            raise ValueError("The sample period has to be positive!")
+        if decimation < 1:
+            raise ValueError("Decimation has to be at least 1!")
         self.ptime = ptime
         self.flat  = flat
-        self.nflat = int(flat/4)
-        self.nramp = int(ptime/4) 
+        self.sample_period = sample_period
+        self.decimation = int(decimation)
+        # rounded to the nearest (decimated) sample, as in the c++ filter
+        self.nflat = int(np.floor(flat/(sample_period*self.decimation) + 0.5))
+        self.nramp = int(np.floor(ptime/(sample_period*self.decimation) + 0.5))
         self.ntot  = int(2*self.nramp + self.nflat)
-        i_s = np.arange(self.ntot,recordlength,1)
+        # the windows grow with nramp times the record length,
+        # so decimation saves quadratically here
+        i_s = np.arange(self.ntot,recordlength//self.decimation,1)
         j_s = np.arange(0, self.nramp, 1)
         self.windows  = np.array([[i - j for j in j_s] for i in i_s])
 
@@ -42,6 +55,10 @@ class TrapezoidalFilter(object):
             waveform (np.ndarray)  :  input waveform, baseline corrected 
 
         """
+        if self.decimation > 1:
+            nblocks  = len(waveform)//self.decimation
+            waveform = np.asarray(waveform[:nblocks*self.decimation], dtype=np.float64)
+            waveform = waveform.reshape(nblocks, self.decimation).mean(axis=1)
         amp_filter = np.array([(waveform[index] - waveform[index - self.nramp - self.nflat]).sum()/self.nramp for index in self.windows], dtype=np.int16)
 
         #amp_filter = np.array([waveform[riseindex].sum() + waveform[downindex].sum() for (riseindex, downindex) in zip(k,l)])
@@ -19,6 +19,8 @@ from .utils import get_stripname, plot_waveform
 # shaping stuff 
 #from .shaping import GaussShaper, TrapezoidalFilter
 from . import shaping as sh
+# float waveforms can not go through the c++ kernels, which take int16
+from .shaping.trapezoidal_shaper import TrapezoidalFilter as PyTrapezoidalFilter
 
 import dactylos
 
@@ -26,7 +28,7 @@ logger = hep.logger.get_logger(dactylos.LOGLEVEL)
 
 ########################################################################
 
-def read_waveform(infile, ch, entrystop=None, save_memory=True):
+def read_waveform(infile, ch, entrystop=None, save_memory=True, subtract_baseline=True):
     """
     Return waveform data from a rootfile with uproot
 
@@ -38,6 +40,10 @@ def read_waveform(infile, ch, entrystop=None, save_memory=True):
         entrystop   (int)  : last entry - if None, read all
         save_memory (bool) : make sure to use as less memory as possible
                              by strictly sticking to int16
+        subtract_baseline (bool) : subtract the baseline in python. The native
+                                   shapers estimate and subtract the baseline
+                                   themselves, so this can be switched off
+                                   if they are available
     Returns:
         ndarray : numpy array with waveform data. Waveform data is in
                   digitizer channels and of length of the record length
@@ -45,6 +51,17 @@ def read_waveform(infile, ch, entrystop=None, save_memory=True):
     """
     f = up.open(infile)
     data = f.get('ch' + str(ch)).get('waveform').array(entry_stop=entrystop)
+    if not subtract_baseline:
+        # copy the raw samples straight into a single int16 block,
+        # without any temporary per waveform
+        waveforms = [k for k in data if len(k) > 0]
+        nsamples  = len(waveforms[0]) if waveforms else 0
+        block = np.empty((len(waveforms), nsamples), dtype=np.int16)
+        for i, k in enumerate(waveforms):
+            block[i] = k
+        logger.info(f'Read out {len(block)} events for channel {ch}')
+        return ch, block
+
     # we omit empty events here. This should not happen
     # but might happen during digitizer software debugging
     data = [baseline_correction(k, nsamples=1000)[0] for k in data if len(k) > 0]
@@ -129,6 +146,7 @@ class WaveformAnalysis(object):
                                                      for larger peakingtimes automatically
         """
         self.files = []
+        self.njobs = njobs
         self.tpexecutor = fut.ThreadPoolExecutor(max_workers=njobs)
         self.ppexecutor = fut.ProcessPoolExecutor(max_workers=njobs)
         self.active_channels = active_channels
@@ -137,6 +155,11 @@ class WaveformAnalysis(object):
         self.adjust_shaper_order_dynamically = adjust_shaper_order_dynamically
         self.use_simple_trapezoid_shaper = use_simple_trapezoid_shaper
         self.recordlengths = dict()
+        # sample period in seconds, see set_shaping_parameters
+        self.dt = 4e-9
+        # set by read_waveforms, raw waveforms are only
+        # shaped by the native shapers
+        self.baseline_subtracted = True
 
     def get_recordlengths(self):
         """
@@ -237,7 +260,7 @@ class WaveformAnalysis(object):
         """
         self.files = infiles
 
-    def read_waveforms(self, entrystop=None, save_memory=True):
+    def read_waveforms(self, entrystop=None, save_memory=True, subtract_baseline=True):
         """
         Read the waveforms from the files
 
@@ -245,17 +268,23 @@ class WaveformAnalysis(object):
             entrystop (int)    : if not None, read only entrystop waveforms
             save_memory (bool) : make sure to use as less memory as possible
                                  by strictly sticking to int16
+            subtract_baseline (bool) : do the baseline correction in python. If False,
+                                       the raw int16 samples are kept, and analyze
+                                       leaves the baseline to the native shapers, 
+                                       which subtract it while shaping. This saves
+                                       a pass over the data, but needs the c++ extension.
 
         Returns:
             None
         """
+        self.baseline_subtracted = subtract_baseline
         future_to_fname = dict()
 
         for fname in self.files:
             # read out every file once per channel
             for ch in self.active_channels:
                 #read_waveform(fname, ch)
-                future_to_fname[self.tpexecutor.submit(read_waveform, fname, ch, entrystop = entrystop, save_memory=save_memory)] = fname
+                future_to_fname[self.tpexecutor.submit(read_waveform, fname, ch, entrystop = entrystop, save_memory=save_memory, subtract_baseline=subtract_baseline)] = fname
 
         logger.info("Readout jobs submitted..")
         init_ch = [False]*8
@@ -263,7 +292,8 @@ class WaveformAnalysis(object):
             ch, data = future.result()    
             #if sh.WAVEFORMTYPE == 'ARRAY':
             if save_memory:
-                data = np.array([np.array(k, dtype=np.int16) for k in data])
+                # no copy if this is already an int16 block
+                data = np.asarray(data, dtype=np.int16)
             if not init_ch[ch]:
                 self.channel_data[ch] = data
                 init_ch[ch] = True
@@ -326,9 +356,103 @@ class WaveformAnalysis(object):
         wfplot.savefig(savename)
         return savename 
 
+    def find_optimal_peakingtime(self, channel, peakingtimes=None, nbaseline=1000, flat=1000):
+        """
+        Estimate the noise of the trapezoid from the pre-trigger part of
+        the waveforms for a dense grid of peaking times, and return the
+        one with the smallest noise. This is much faster than shaping the
+        full spectra, and can be used to narrow down the peakingtime sequence.
+
+        Args:
+            channel (int)          : digitizer channel
+
+        Keyword Args:
+            peakingtimes (ndarray) : peaking times in ns, if None a logarithmic
+                                     grid from 100ns up to the longest peaking
+                                     time whose trapezoid fits into the baseline
+                                     (at most 40us)
+            nbaseline (int)        : number of baseline only samples at the
+                                     beginning of the waveforms
+            flat (int)             : flat top in ns
+
+        Returns:
+            tuple                  : (optimal peaking time in ns, peakingtimes,
+                                      noise in adc counts for each of them,
+                                      NaN where the trapezoid does not fit)
+        """
+        if not hasattr(sh, 'ENCScanner'):
+            raise NotImplementedError("The noise scan needs the c++ extension!")
+        data  = np.ascontiguousarray(self.channel_data[channel], dtype=np.int16)
+        nsegment = min(nbaseline, data.shape[1]) if nbaseline > 0 else data.shape[1]
+        # the trapezoid spans 2*peakingtime + flat top
+        sample_period = 1e9*self.dt
+        max_ptime = ((nsegment - int(np.ceil(flat/sample_period)))//2)*sample_period
+        if peakingtimes is None:
+            if max_ptime < 100:
+                raise ValueError(f'A baseline of {nsegment} samples is too short for a flat top of {flat} ns, use a longer baseline or a shorter flat top!')
+            peakingtimes = np.unique(np.geomspace(100, min(max_ptime, 40000), 64).astype(int))
+        peakingtimes = [int(k) for k in peakingtimes]
+        scanner = sh.ENCScanner(peakingtimes, flat, nbaseline, sample_period)
+        noise = scanner.scan(data, self.njobs)
+        dropped = [ptime for ptime, n in zip(peakingtimes, noise) if np.isnan(n)]
+        if dropped:
+            logger.warning(f'Peaking times {dropped} ns do not fit into a baseline of {nsegment} samples with a flat top of {flat} ns, they are skipped!')
+        best  = scanner.best_ptime(noise)
+        logger.info(f'Lowest noise for channel {channel} at a peaking time of {best} ns')
+        return best, np.array(peakingtimes), noise
+
+    def get_noise_psd(self, channel, nbaseline=1000, nfft=None, psd=None):
+        """
+        Averaged noise power spectral density (Welch) of the pre-trigger
+        samples of all waveforms of a channel, in adc counts^2/Hz.
+
+        Args:
+            channel (int)          : digitizer channel
+
+        Keyword Args:
+            nbaseline (int)        : number of baseline only samples at the
+                                     beginning of the waveforms
+            nfft (int)             : segment length, a power of 2, segments
+                                     overlap by half. By default the largest
+                                     power of 2 up to nbaseline/2, so there are
+                                     at least 3 segments per waveform
+            psd (NoisePSD)         : accumulate on top of an existing spectrum,
+                                     e.g. to average over several files
+
+        Returns:
+            tuple                  : (frequencies in Hz, density, NoisePSD)
+        """
+        if not hasattr(sh, 'NoisePSD'):
+            raise NotImplementedError("The noise spectrum needs the c++ extension!")
+        data = np.ascontiguousarray(self.channel_data[channel], dtype=np.int16)
+        if psd is None:
+            if nfft is None:
+                nsegment = min(nbaseline, data.shape[1]) if nbaseline > 0 else data.shape[1]
+                nfft = 4
+                while 2*nfft <= nsegment//2:
+                    nfft *= 2
+            psd = sh.NoisePSD(nfft, nfft//2, 1e9*self.dt)
+        psd.add(data, nbaseline, self.njobs)
+        return psd.get_frequencies(), psd.get_psd(), psd
+
+    def _get_shaper_order(self, ptime):
+        """
+        The order of the gaussian shaper for a peaking time in ns
+        """
+        if self.adjust_shaper_order_dynamically:
+            if 500 < ptime <= 1000:
+                return 3
+            elif ptime <= 500:
+                return 2
+            else:
+                return 7
+        return self.order
+
     def analyze(self, channel, save_shp_file=False):
         """
         Applyt the gaussian shaping algorithm on the waveform data.
+        Waveforms read with read_waveforms(subtract_baseline=False) are
+        shaped raw, the native shapers subtract the baseline themselves.
         
         Args:
             channel (int)        : Select the channel
@@ -343,24 +467,45 @@ class WaveformAnalysis(object):
 
         #data = copy(self.channel_data[channel])
         data = self.channel_data[channel]
+        # the trapezoid only sees differences of samples, the gaussian
+        # shaper needs the baseline subtracted
+        if not (self.baseline_subtracted or self.use_simple_trapezoid_shaper or sh.HAS_NATIVE_SHAPER):
+            raise ValueError("The waveforms were read without baseline subtraction, which needs the c++ extension for the gaussian shaper!")
+        nbaseline = 0 if self.baseline_subtracted else 1000
+        # the native kernels take int16 samples, casting float (baseline
+        # corrected) waveforms would truncate them. These are shaped with
+        # the python versions instead, as GaussShaper.shape_it does
+        native_input = np.issubdtype(data.dtype, np.integer)
+        if native_input and (not self.use_simple_trapezoid_shaper) and hasattr(sh, 'TileScheduler'):
+            # all peaking times over cache sized blocks of waveforms,
+            # instead of streaming the whole dataset once per peaking time
+            logger.info(f'Applying gaussian shaper for channel {channel} for {len(self.peakingtime_sequence)} peaking times..')
+            settings = [sh.ShaperSetting(sh.ShaperKind.Gaussian, int(ptime), self._get_shaper_order(ptime))\
+                        for ptime in self.peakingtime_sequence]
+            scheduler = sh.TileScheduler(settings, sample_period=1e9*self.dt, nbaseline=nbaseline)
+            energies, tiles = scheduler.run(np.ascontiguousarray(data, dtype=np.int16), self.njobs)
+            logger.debug(f'{len(tiles)} tiles, {tiles["msamples_per_s"].mean():4.1f} MSamples/s per tile, {tiles["stolen"].sum()} stolen')
+            for i, ptime in enumerate(self.peakingtime_sequence):
+                ptime_energies[ptime] = np.asarray(energies[:,i], dtype=np.float16)
+            return ptime_energies
+
         for ptime in tqdm.tqdm(self.peakingtime_sequence, desc=f"Applying shaper for channel {channel}.."):
-            if self.adjust_shaper_order_dynamically:
-                if 500 < ptime <= 1000:
-                    order = 3
-                elif ptime <= 500:
-                    order = 2
-                else:
-                    order = 7
-            else:
-                order = self.order
+            order = self._get_shaper_order(ptime)
             if self.use_simple_trapezoid_shaper:
                 #shaper = TrapezoidalFilter(ptime = ptime, recordlength = self.recordlengths[channel])
-                shaper = sh.TrapezoidalFilter(ptime, 1000, self.recordlengths[channel])
+                trapezoid = sh.TrapezoidalFilter if native_input else PyTrapezoidalFilter
+                shaper = trapezoid(ptime, 1000, self.recordlengths[channel], 1e9*self.dt)
+            else:
+                shaper = sh.GaussShaper(ptime, order=order, dt=self.dt, nbaseline=nbaseline)
+            if native_input and hasattr(shaper, 'shape_batch'):
+                # the c++ shaper works on the whole int16 block at once
+                # with its own threads, no need to pickle every waveform
+                energies = shaper.shape_batch(np.ascontiguousarray(data, dtype=np.int16), self.njobs)
+                energies = np.asarray(energies, dtype=np.float16)
             else:
-                shaper = sh.GaussShaper(ptime, order=order)
-            #if self.njobs > 1:
-            energies = np.array([energy for energy in self.ppexecutor.map(shaper.shape_it, data, chunksize=10)], dtype=np.float16) # use 16 bit dtype, since the input is only 16 bit anyway.
-                     # and this will save memory
+                #if self.njobs > 1:
+                energies = np.array([energy for energy in self.ppexecutor.map(shaper.shape_it, data, chunksize=10)], dtype=np.float16) # use 16 bit dtype, since the input is only 16 bit anyway.
+                         # and this will save memory
             #else:
             #energies = np.array([shaper.shaper_it(wf) for wf in data])
             ptime_energies[ptime] = energies 
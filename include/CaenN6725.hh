@@ -3,6 +3,8 @@
 
 #include <vector>
 #include <iostream>
+#include <atomic>
+#include <mutex>
 
 //#define CAEN_DGTZ_BoardInfo_t _TRASH_
 
@@ -13,6 +15,10 @@
 #include "TFile.h"
 #include "TTree.h"
 
+#include "spsc_queue.h"
+#include "readout_buffer_pool.hh"
+#include "dpp_decoder.hh"
+
 
 /************************************************************************/
 
@@ -130,6 +136,56 @@ struct DigitizerParams_t
 
 /************************************************************************/
 
+// the event words of a DPP-PHA event, as in CAEN_DGTZ_DPP_PHA_Event_t
+// but without the format and the pointer to the encoded waveform
+struct DPPEventRecord_t
+{
+    uint64_t time_tag;
+    uint16_t energy;
+    int16_t  extras;
+    uint32_t extras2;
+};
+
+/************************************************************************/
+
+// how to wait for the board to have data
+enum class WaitPolicy : int
+{
+    Poll    = 0, // read the status register back to back
+    Backoff = 1, // read the status register, sleep longer and longer in between
+    IRQ     = 2  // sleep until the board raises an interrupt, waits for one
+                 // event instead of a full buffer. Untested on a digitizer
+};
+
+/************************************************************************/
+
+// how the waits for data went
+struct WaitStats_t
+{
+    uint64_t nwaits;       // number of waits
+    uint64_t npolls;       // status register reads
+    uint64_t nirqs;        // interrupts received
+    uint64_t ntimeouts;    // waits which ended without data
+    double   mean_wait_us; // average time until there was data
+    double   max_wait_us;  // longest time until there was data
+};
+
+/************************************************************************/
+
+// what went through one queue of the readout pipeline
+struct PipelineStats_t
+{
+    std::string queue;      // "readout->decode" or "decode->write"
+    uint64_t    nblocks;    // number of blocks which went through the queue
+    uint64_t    nfull;      // times the producer had to wait for a free buffer/block,
+                            // once per wait however long it took
+    uint64_t    nempty;     // times the consumer had to wait for the next block
+    uint32_t    max_depth;  // largest number of blocks waiting in the queue
+    double      mean_depth; // average number of blocks waiting, seen after every push
+};
+
+/************************************************************************/
+
 // string representation for numerical error codes
 std::string error_code_to_string(CAEN_DGTZ_ErrorCode err);
 // string representation coined into an operator
@@ -335,6 +391,7 @@ class CaenN6725DPPPHA {
         // this needs to be called before any 
         // acquisition is started
         // to allocate the internal buffers
+        // (see set_pipeline_depth for their number)
         void allocate_memory();
 
         // return the size of the allocated buffer in 
@@ -368,6 +425,15 @@ class CaenN6725DPPPHA {
         // for the get_traces functions
         std::vector<std::vector<CAEN_DGTZ_DPP_PHA_Event_t>> read_data(bool fill_histogram = false);
 
+        // same as read_data, but only the event words are kept, in
+        // buffers which are reused from call to call, so nothing is
+        // allocated once they are large enough. The records stay valid
+        // until the next call. False if there was nothing to read
+        bool read_data_records(bool fill_histogram = false);
+
+        // the events of a channel from the last read_data_records call
+        const std::vector<DPPEventRecord_t>& get_event_records(int channel) const;
+
         // get the number of events acquired per read_data call
         std::vector<int> get_n_events();
         
@@ -393,24 +459,53 @@ class CaenN6725DPPPHA {
 
         // read out the digitizer continuously
         // @param seconds : read out time
+        // read_data, read_data_records and continuous_readout throw
+        // while one of the others runs in another thread
         void continuous_readout(unsigned int seconds);        
+
+        // number of readout buffers (each with its own event and
+        // waveform buffers) in the pool, that is how many blocks
+        // continuous_readout keeps in flight. The board is drained
+        // into a free buffer while the others are still decoded.
+        // Reallocates the buffers if they are allocated already,
+        // throws while a readout runs
+        void set_pipeline_depth(unsigned int depth);
+
+        // queue statistics of the last continuous_readout
+        std::vector<PipelineStats_t> get_pipeline_stats() const;
+
+        // how read_data and continuous_readout wait for data
+        // @param policy         : poll, poll with backoff or interrupts
+        // @param max_backoff_us : longest sleep between two polls (Backoff)
+        // @param irq_timeout_ms : longest wait for an interrupt before the
+        //                         status is checked again (IRQ)
+        void set_wait_policy(WaitPolicy policy, unsigned int max_backoff_us = 100,
+                             unsigned int irq_timeout_ms = 100);
+
+        // poll counts and wait latency since the last reset
+        WaitStats_t get_wait_stats() const;
+        void reset_wait_stats();
     
         // the name of the file containing waveforms + energy
         void set_rootfilename(std::string fname);
        
         // replaces the upper functions. If the virtual/digital probes 
         // are set, the traces will contain the respective values, 
-        // depending on the setting of the probes
-        std::vector<int16_t> get_analog_trace1();
-        std::vector<int16_t> get_analog_trace2();
-        std::vector<uint8_t> get_digital_trace1();
-        std::vector<uint8_t> get_digital_trace2();
+        // depending on the setting of the probes.
+        // The buffers are reused for every event, so the references
+        // are only valid until the next read_data
+        const std::vector<int16_t>& get_analog_trace1() const;
+        const std::vector<int16_t>& get_analog_trace2() const;
+        const std::vector<uint8_t>& get_digital_trace1() const;
+        const std::vector<uint8_t>& get_digital_trace2() const;
         
         // acces the last seen energy
         uint16_t get_energy();
 
 
-        std::vector<int16_t> get_last_waveform(int channel);
+        // the analog trace1 of the last event of the channel,
+        // valid until the next read_data
+        const std::vector<int16_t>& get_last_waveform(int channel) const;
         // set the virtualprobes for traces 1 and 2
         // this defines what will be stored in the waveform field 
         // of the dpp event
@@ -443,24 +538,76 @@ class CaenN6725DPPPHA {
         // if a particular channel is active
         uint8_t active_channel_bitmask_;
 
-        // internal readout method, use read_data
-        // if you want to interface with the individual 
-        // data. This method is used by continuous_readout
-        // and in the end only will save data to disk
-        void fast_readout_();
+        // read one block from the board. Fills the energy histogram,
+        // decodes the waveforms and fills the trees as configured, and
+        // calls on_event(channel, event) for every event. False if
+        // there was nothing to read
+        template<typename Func>
+        bool read_block_(bool fill_histogram, Func on_event);
+
+        // wait until all bits of status_mask are set in the acquisition
+        // status register, following the wait policy. False if there was
+        // no data within timeout_ms (negative for no timeout)
+        bool wait_for_data_(uint32_t status_mask, long timeout_ms);
+
+        WaitPolicy   wait_policy_    = WaitPolicy::Backoff;
+        unsigned int max_backoff_us_ = 100;
+        unsigned int irq_timeout_ms_ = 100;
+        // written by the readout thread, read from python
+        mutable std::mutex wait_stats_mutex_;
+        WaitStats_t  wait_stats_     = {};
+        double       wait_us_total_  = 0;
+
+        // the stages of continuous_readout, each one runs in its own
+        // thread, connected by queues. The readout stage only drains
+        // the board, the decode stage unpacks the events and waveforms
+        // and the write stage fills and writes the trees. A stage
+        // stops when the stage before is done and its queue is empty
+        void readout_stage_(unsigned int seconds,
+                            SPSCQueue<ReadoutBuffer_t*> &filled,
+                            std::atomic<bool> &done);
+        void decode_stage_(SPSCQueue<ReadoutBuffer_t*> &filled,
+                           SPSCQueue<DecodedBlock_t*> &free_blocks,
+                           SPSCQueue<DecodedBlock_t*> &decoded,
+                           std::atomic<bool> &readout_done,
+                           std::atomic<bool> &done);
+        void write_stage_(SPSCQueue<DecodedBlock_t*> &decoded,
+                          SPSCQueue<DecodedBlock_t*> &free_blocks,
+                          std::atomic<bool> &decode_done);
+
+        // number of buffers in the pool
+        unsigned int pipeline_depth_ = 4;
+        // set while continuous_readout, read_data(_records) or the
+        // reallocation in set_pipeline_depth runs. They all use the
+        // buffer pool, the traces and the trees, only one at a time
+        std::atomic<bool> readout_running_{false};
+
+        // holds readout_running_ while it lives, throws if it is
+        // taken already
+        struct ReadoutGuard_
+        {
+            explicit ReadoutGuard_(std::atomic<bool> &running);
+            ~ReadoutGuard_();
+            std::atomic<bool> &running;
+        };
+        // one entry per queue of the pipeline
+        std::vector<PipelineStats_t> pipeline_stats_ = {};
         
         // number of acquired events per acquistion interval
         // [start acqusitizion , stop acquisitioin
         std::vector<long> n_events_acq_ = {};
 
         // length of the waveforms
-        int recordlength_;
+        int recordlength_ = 0;
 
         // is this instance connected to the digitizer 
         // and has a handle assigned?
         bool is_connected_;
 
-        // fill the internal field for the traces
+        // fill the internal field for the traces. They are copied into
+        // buffers which are kept from event to event, and which are
+        // reserved for the record length, so they do not allocate
+        void reserve_traces_();
         void fill_analog_trace1_();
         void fill_analog_trace2_();
         void fill_digital_trace1_();
@@ -496,14 +643,12 @@ class CaenN6725DPPPHA {
         CAENDigitizer API functions (see below), so they must not be initialized here
         NB: you must use the right type for different DPP analysis (in this case PHA) */
         uint32_t                        allocated_size_ = 0;
-        uint32_t                        buffer_size_ = 0;
-        char*                           buffer_ = nullptr; // readout buffer
-        CAEN_DGTZ_DPP_PHA_Event_t*      events_[max_n_channels_];  // events buffer
-        CAEN_DGTZ_DPP_PHA_Waveforms_t*  waveform_ = nullptr;     // waveforms buffer
+        ReadoutBufferPool               pool_;  // readout, events and waveform buffers
+        CAEN_DGTZ_DPP_PHA_Waveforms_t*  waveform_ = nullptr;     // waveforms buffer of the last read_data
         CAEN_DGTZ_BoardInfo_t           board_info_;
         uint32_t                        num_events_[max_n_channels_];
-};
-        bool                            decode_waveforms_;
+        std::vector<DPPEventRecord_t>   event_records_[max_n_channels_]; // for read_data_records
+        bool                            decode_waveforms_ = false;
 
         // save data to a rootfle
         std::string                        rootfile_name_  = "digitizer_output.root";
@@ -522,12 +667,12 @@ class CaenN6725DPPPHA {
         std::vector<uint8_t> digital_trace1_;
         std::vector<uint8_t> digital_trace2_;
 
-        int16_t* atrace1_;
-        int16_t* atrace2_;
-        uint8_t* dtrace1_;
-        uint8_t* dtrace2_;
-        uint32_t trace_ns_;
-        uint16_t energy_; // the last seen energy 
+        int16_t* atrace1_ = nullptr;
+        int16_t* atrace2_ = nullptr;
+        uint8_t* dtrace1_ = nullptr;
+        uint8_t* dtrace2_ = nullptr;
+        uint32_t trace_ns_ = 0;
+        uint16_t energy_ = 0; // the last seen energy 
         
         // aggregate quantities for all readout events
         std::vector<long> channel_triggers_;
@@ -537,4 +682,6 @@ class CaenN6725DPPPHA {
         std::vector<std::vector<uint32_t>> energy_histogram_;
         // this is basically the overflow bin for the energy histogram
         std::vector<uint32_t>fail_events_;
+};
+
 #endif
@@ -0,0 +1,30 @@
+#ifndef BASELINE_H_INCLUDED
+#define BASELINE_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+/**
+ * Baseline estimation from the pre-trigger samples at the 
+ * beginning of a waveform. The shapers call this right before
+ * they filter the waveform, so the baseline subtraction does
+ * not need an extra pass (or an extra copy) of the data.
+ */
+enum class BaselineMode : int
+{
+    Mean          = 0, // mean of the first nbaseline samples
+    Median        = 1, // median, robust against pulses in the pre-trigger window
+    TruncatedMean = 2  // mean of the samples between the 10% and 90% quantiles
+};
+
+/**
+ * @param : waveform    - the samples
+ * @param : nsamples    - number of samples of the waveform
+ * @param : nbaseline   - number of pre-trigger samples to use,
+ *                        0 means the waveform has no baseline (returns 0)
+ * @param : mode        - the estimator
+ */
+float estimate_baseline(const int16_t* waveform, size_t nsamples, size_t nbaseline, BaselineMode mode);
+
+#endif
+
@@ -0,0 +1,46 @@
+#ifndef DPP_DECODER_H_INCLUDED
+#define DPP_DECODER_H_INCLUDED
+
+#include <vector>
+#include <stdint.h>
+
+#include "readout_buffer_pool.hh"
+
+/************************************************************************/
+
+// the decoded events of one readout buffer, handed from the
+// decode to the write stage of continuous_readout
+struct DecodedBlock_t
+{
+    // per channel, one entry per event
+    std::vector<uint16_t> energy[8];
+    std::vector<int>      trigger[8];
+    std::vector<uint8_t>  saturated[8];
+    std::vector<uint32_t> nsamples[8];
+    // per channel, the analog trace1 of all events back to back
+    std::vector<int16_t>  waveforms[8];
+};
+
+/************************************************************************/
+
+// the first sample of the digital trace2 (trigger) which is set,
+// the number of samples if there is none. Same as get_trigger_point,
+// but on the decoded waveform directly
+int find_trigger_point(const uint8_t* dtrace2, uint32_t ns);
+
+/**
+ * Unpack the events of a readout buffer, after CAEN_DGTZ_GetDPPEvents
+ * filled raw->events, into block. This is the energy and the saturation
+ * flag of every event, and with decode_waveforms the analog trace1 and
+ * the trigger point (fast mode, the other traces are not kept). The
+ * waveforms are decoded with CAEN_DGTZ_DecodeDPPWaveforms into
+ * raw->waveform. The vectors of block are cleared, not freed, so they
+ * stop allocating once they are large enough.
+ *
+ * @param : channel_mask - only these channels are filled, the
+ *                         others are left empty
+ */
+void decode_readout_buffer(int handle, ReadoutBuffer_t* raw, DecodedBlock_t* block,
+                           uint32_t channel_mask, bool decode_waveforms);
+
+#endif
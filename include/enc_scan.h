@@ -0,0 +1,61 @@
+#ifndef ENC_SCAN_H_INCLUDED
+#define ENC_SCAN_H_INCLUDED
+
+#include <vector>
+#include <stdint.h>
+#include <cstddef>
+
+/**
+ * Equivalent noise charge of the trapezoid for a whole grid of
+ * peaking times, estimated from baseline-only segments (the
+ * pre-trigger part of the waveforms, or waveforms without pulse).
+ * A step of height A gives an output of A, so the rms of the
+ * trapezoid on the baseline is the noise in adc counts, which is
+ * the ENC in adc counts. The minimum over the grid is the optimum
+ * peaking time, without shaping full spectra.
+ * Every segment is integrated once (see cumulative_sum), and all
+ * peaking times are evaluated from this integral while it is in
+ * the cache. Neighbouring outputs of the trapezoid are strongly
+ * correlated, so only every nramp/16-th is used, which makes the
+ * long peaking times cheap.
+ */
+class ENCScanner{
+
+  public:
+    /**
+     *
+     * @param : ptimes        - the grid of peaking times in ns
+     * @param : flat          - flat top in ns
+     * @param : nbaseline     - number of samples at the beginning of every
+     *                          waveform which are baseline only, 0 for all
+     * @param : sample_period - time between two samples in ns
+     */
+    ENCScanner(std::vector<int> const &ptimes, int flat = 1000, size_t nbaseline = 0,
+               float sample_period = 4);
+
+    /**
+     * The rms of the trapezoid over all baseline segments of a block
+     * of waveforms (row major), one value per peaking time. NaN for
+     * peaking times whose trapezoid does not fit into the segment.
+     *
+     * @param : data         - nwaveforms*nsamples samples
+     * @param : nwaveforms   - number of waveforms (rows)
+     * @param : nsamples     - number of samples per waveform
+     * @param : noise        - output, ptimes.size() values in adc counts
+     * @param : nthreads     - number of threads, 0 means one per core
+     */
+    void scan(const int16_t* data, size_t nwaveforms, size_t nsamples,
+              float* noise, int nthreads = 0) const;
+
+    // the peaking time with the smallest noise, throws if all of them are NaN
+    int best_ptime(const float* noise) const;
+
+  public:
+    std::vector<int> ptimes;
+    int flat;
+    size_t nbaseline;
+    float sample_period;
+};
+
+#endif
+
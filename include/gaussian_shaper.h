@@ -0,0 +1,86 @@
+#ifndef GAUSSIAN_SHAPER_H_INCLUDED
+#define GAUSSIAN_SHAPER_H_INCLUDED
+
+#include <vector>
+#include <stdint.h>
+#include <cstddef>
+
+#include "baseline.h"
+
+/**
+ * Semi-gaussian shaper following Ohkawa 1976, "Direct synthesis
+ * of the Gaussian filter for nuclear pulse amplifiers". This is
+ * the native version of dactylos/analysis/shaping/shapers.py,
+ * the pole tables for the orders 1-7 are the same.
+ * The analog poles and the pole-zero cancellation zero are
+ * transformed with the bilinear transform and grouped into
+ * second order sections. These are computed once in the
+ * constructor.
+ * For peaking times of several microseconds the poles sit within
+ * 1e-3 of the unit circle, single precision coefficients move them
+ * enough to change the gain by up to 20%. The cascade therefore
+ * runs in double precision, but over several waveforms at once,
+ * which hides the latency of the recursion.
+ */
+class GaussianShaper{
+
+  public:
+    /**
+     *
+     * @param : peaktime    - peaking time in ns
+     * @param : order       - order of the shaper (1-7)
+     * @param : dt          - sample period in ns (4 ns for the N6725)
+     * @param : decay_time  - decay time of the input tail pulses in ns,
+     *                        used for the pole-zero correction.
+     * @param : nbaseline   - number of pre-trigger samples for the baseline
+     *                        which is subtracted before shaping, 0 if the
+     *                        waveforms are already baseline corrected
+     * @param : baseline_mode - estimator for the baseline
+     */
+    GaussianShaper(double peaktime, int order = 4, double dt = 4, double decay_time = 80000,
+                   int nbaseline = 1000, BaselineMode baseline_mode = BaselineMode::Mean);
+
+    // the maximum of the shaped waveform
+    float shape_it(std::vector<int16_t> const &waveform) const;
+
+    // see TrapezoidalFilter::shape_batch
+    void shape_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                     float* energies, int nthreads = 0) const;
+
+    // the full shaped waveforms, written into a buffer provided by the
+    // caller, see TrapezoidalFilter::shape_traces
+    void shape_traces(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                      float* traces, size_t decimation = 1, int nthreads = 0) const;
+
+    // the second order sections as (b0, b1, b2, a0, a1, a2), the
+    // same layout as scipy.signal.zpk2sos
+    std::vector<std::vector<double>> get_sos() const;
+
+  public:
+    // sections of the highest order (7)
+    static const size_t MAXNSECTIONS = 4;
+
+    double peaktime;
+    int order;
+    double dt;
+    double decay_time;
+    int nbaseline;
+    BaselineMode baseline_mode;
+
+  private:
+    // a0 is always 1
+    struct Section {
+      double b0, b1, b2, a1, a2;
+    };
+    std::vector<Section> sections_;
+
+    // shape NLANES consecutive waveforms of a block interleaved. If
+    // traces is not null, every decimation-th sample of the output
+    // is written there (row length ntrace)
+    template<size_t NLANES>
+    void shape_lanes_(const int16_t* data, size_t nsamples, float* energies,
+                      float* traces = nullptr, size_t ntrace = 0, size_t decimation = 1) const;
+};
+
+#endif
+
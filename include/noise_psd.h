@@ -0,0 +1,81 @@
+#ifndef NOISE_PSD_H_INCLUDED
+#define NOISE_PSD_H_INCLUDED
+
+#include <vector>
+#include <complex>
+#include <mutex>
+#include <stdint.h>
+#include <cstddef>
+
+/**
+ * Averaged noise power spectral density (Welch's method) of the
+ * baseline segments of the waveforms. The pre-trigger part of every
+ * waveform is cut into overlapping segments of nfft samples, each
+ * has its mean removed, is multiplied with a Hann window and Fourier
+ * transformed. The periodograms are summed up, so any number of
+ * waveforms can be added in batches with constant memory.
+ * The result is the one-sided density in adc counts^2/Hz, with the
+ * same scaling as scipy.signal.welch(..., scaling='density').
+ * The FFT is an iterative radix-2 transform, two real segments are
+ * transformed at once as real and imaginary part of one complex one.
+ */
+class NoisePSD{
+
+  public:
+    /**
+     *
+     * @param : nfft          - segment length, a power of 2
+     * @param : noverlap      - overlap of neighbouring segments in samples
+     * @param : sample_period - time between two samples in ns
+     */
+    NoisePSD(size_t nfft = 1024, size_t noverlap = 512, float sample_period = 4);
+
+    /**
+     * Add the baseline segments of a block of waveforms (row major)
+     *
+     * @param : data         - nwaveforms*nsamples samples
+     * @param : nwaveforms   - number of waveforms (rows)
+     * @param : nsamples     - number of samples per waveform
+     * @param : nbaseline    - number of baseline samples at the beginning
+     *                         of every waveform, 0 for all of them
+     * @param : nthreads     - number of threads, 0 means one per core
+     */
+    void add(const int16_t* data, size_t nwaveforms, size_t nsamples, size_t nbaseline = 0,
+             int nthreads = 0);
+
+    // the averaged density (nfft/2 + 1 values) in adc counts^2/Hz
+    std::vector<double> get_psd() const;
+
+    // the frequencies of the bins in Hz
+    std::vector<double> get_frequencies() const;
+
+    // number of segments added so far
+    uint64_t get_nsegments() const;
+
+    // forget everything added so far
+    void reset();
+
+  public:
+    size_t nfft;
+    size_t noverlap;
+    float sample_period;
+
+  private:
+    typedef std::complex<double> complex_t;
+
+    std::vector<double> window_;
+    std::vector<complex_t> twiddles_;
+    std::vector<uint32_t> bitreverse_;
+    // the sum of the periodograms
+    std::vector<double> sum_;
+    uint64_t nsegments_;
+    std::mutex mutex_;
+
+    void fft_(std::vector<complex_t> &z) const;
+    // add the periodograms of one or two segments (b may be null)
+    void add_segments_(const int16_t* a, const int16_t* b, std::vector<complex_t> &z,
+                       std::vector<double> &sum) const;
+};
+
+#endif
+
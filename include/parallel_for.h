@@ -0,0 +1,121 @@
+#ifndef PARALLEL_FOR_H_INCLUDED
+#define PARALLEL_FOR_H_INCLUDED
+
+#include <algorithm>
+#include <atomic>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <cstddef>
+
+/**
+ * Split the index range [0, n) into chunks and hand them out
+ * to a number of native threads. The chunks are fetched from a
+ * shared counter, so threads which finish early simply pick up
+ * the next chunk.
+ *
+ * @param : n        - number of work items (e.g. waveforms)
+ * @param : nthreads - number of threads, 0 means one per core
+ * @param : func     - callable with signature func(begin, end)
+ * @param : chunk    - number of work items fetched at once
+ */
+template<typename Func>
+void parallel_for(size_t n, int nthreads, Func func, size_t chunk = 16)
+{
+  if (n == 0) return;
+  if (nthreads <= 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+  if (chunk == 0) chunk = 1;
+  size_t nchunks = (n + chunk - 1)/chunk;
+  if ((size_t)nthreads > nchunks) nthreads = nchunks;
+
+  std::atomic<size_t> next(0);
+  auto worker = [&]() {
+    size_t begin;
+    while ((begin = next.fetch_add(chunk)) < n)
+      {
+        func(begin, std::min(begin + chunk, n));
+      }
+  };
+
+  if (nthreads == 1)
+    {
+      worker();
+      return;
+    }
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads - 1);
+  for (int k=0; k<nthreads-1; k++)
+    {threads.emplace_back(worker);}
+  // the calling thread does its share as well
+  worker();
+  for (auto &t : threads)
+    {t.join();}
+}
+
+/**
+ * Run the tasks [0, n) on a work-stealing pool. Every thread gets a
+ * contiguous range of tasks, which it works through from the front,
+ * so neighbouring tasks (e.g. tiles of neighbouring waveforms) stay
+ * on the same thread. A thread which runs out of tasks steals single
+ * tasks from the back of the ranges of the others. Meant for tasks
+ * which are much longer than taking a lock.
+ *
+ * @param : n        - number of tasks
+ * @param : nthreads - number of threads, 0 means one per core
+ * @param : func     - callable with signature func(task, worker, stolen)
+ */
+template<typename Func>
+void work_stealing_for(size_t n, int nthreads, Func func)
+{
+  if (n == 0) return;
+  if (nthreads <= 0) nthreads = std::max(1u, std::thread::hardware_concurrency());
+  if ((size_t)nthreads > n) nthreads = n;
+
+  struct Range {
+    std::mutex mutex;
+    size_t head;
+    size_t tail;
+  };
+  std::vector<Range> ranges(nthreads);
+  for (int k=0; k<nthreads; k++)
+    {
+      ranges[k].head = k*n/nthreads;
+      ranges[k].tail = (k + 1)*n/nthreads;
+    }
+
+  auto worker = [&](int w) {
+    while (true)
+      {
+        size_t task = n;
+        bool stolen = false;
+        {
+          std::lock_guard<std::mutex> lock(ranges[w].mutex);
+          if (ranges[w].head < ranges[w].tail)
+            {task = ranges[w].head++;}
+        }
+        for (int v=1; (task == n) && (v<nthreads); v++)
+          {
+            Range &victim = ranges[(w + v) % nthreads];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (victim.head < victim.tail)
+              {
+                task   = --victim.tail;
+                stolen = true;
+              }
+          }
+        // nothing left anywhere, and no new tasks get created
+        if (task == n) return;
+        func(task, w, stolen);
+      }
+  };
+
+  std::vector<std::thread> threads;
+  threads.reserve(nthreads - 1);
+  for (int k=1; k<nthreads; k++)
+    {threads.emplace_back(worker, k);}
+  worker(0);
+  for (auto &t : threads)
+    {t.join();}
+}
+
+#endif
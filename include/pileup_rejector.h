@@ -0,0 +1,93 @@
+#ifndef PILEUP_REJECTOR_H_INCLUDED
+#define PILEUP_REJECTOR_H_INCLUDED
+
+#include <vector>
+#include <stdint.h>
+#include <cstddef>
+
+// flags of a found pulse
+enum class PulseFlag : uint8_t
+{
+    Pileup    = 1, // another pulse within the window of the energy filter
+    Truncated = 2  // the energy filter window does not fit into the record
+};
+
+// a single pulse found in a waveform
+struct Pulse_t
+{
+    uint32_t waveform; // index of the waveform in the batch
+    uint32_t trigger;  // sample where the fast filter crossed the threshold
+    float    energy;   // flat top of the energy trapezoid
+    uint8_t  flags;    // PulseFlag bits
+};
+
+/**
+ * Find all pulses in a record instead of taking the global maximum
+ * of the trapezoid. A short trapezoid (the fast filter) triggers on
+ * every pulse, and the energy of each pulse is the maximum of the
+ * long trapezoid (the same as TrapezoidalFilter) within the flat top
+ * following its trigger. Pulses which come closer to each other than
+ * the length of the long trapezoid are flagged as piled up.
+ */
+class PileupRejector{
+
+  public:
+    /**
+     *
+     * @param : ptime        - peaking time of the energy filter in ns
+     * @param : flat         - flat top of the energy filter in ns
+     * @param : fast_ptime   - peaking time of the fast (trigger) filter in ns
+     * @param : fast_flat    - flat top of the fast filter in ns
+     * @param : threshold    - trigger threshold on the fast filter in adc counts
+     * @param : sample_period - time between two samples in ns
+     */
+    PileupRejector(int ptime, int flat = 1000, int fast_ptime = 100, int fast_flat = 100, float threshold = 50,
+                   float sample_period = 4);
+
+    /**
+     * Find the pulses of a single waveform
+     *
+     * @param : waveform     - the samples
+     * @param : nsamples     - number of samples
+     * @param : pulses       - found pulses are appended here
+     * @param : reject       - do not append piled up or truncated pulses
+     * @return               - number of pulses found, including rejected ones
+     */
+    size_t find_pulses(const int16_t* waveform, size_t nsamples, std::vector<Pulse_t> &pulses,
+                       bool reject = false) const;
+
+    /**
+     * Find the pulses of a block of waveforms (row major). The pulses
+     * are ordered by waveform, and per waveform by trigger.
+     *
+     * @param : data         - nwaveforms*nsamples samples
+     * @param : nwaveforms   - number of waveforms (rows)
+     * @param : nsamples     - number of samples per waveform
+     * @param : pulses       - output, all found pulses
+     * @param : npulses      - output, number of pulses per waveform (nwaveforms)
+     * @param : npileup      - output, number of piled up pulses per waveform (nwaveforms)
+     * @param : reject       - do not keep piled up or truncated pulses
+     * @param : nthreads     - number of threads, 0 means one per core
+     */
+    void find_pulses_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                           std::vector<Pulse_t> &pulses, uint32_t* npulses, uint32_t* npileup,
+                           bool reject = false, int nthreads = 0) const;
+
+  public:
+    int ptime;
+    int flat;
+    int fast_ptime;
+    int fast_flat;
+    float threshold;
+    float sample_period;
+
+  private:
+    // triggers and energy filter output are kept in buffers
+    // which are reused for every waveform
+    size_t find_pulses_(const int16_t* waveform, size_t nsamples, std::vector<Pulse_t> &pulses,
+                        bool reject, std::vector<uint32_t> &triggers, std::vector<float> &trapezoid,
+                        uint32_t &npileup) const;
+};
+
+#endif
+
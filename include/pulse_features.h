@@ -0,0 +1,75 @@
+#ifndef PULSE_FEATURES_H_INCLUDED
+#define PULSE_FEATURES_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+#include "baseline.h"
+
+// shape features of the first pulse of a waveform, which starts at the
+// first threshold crossing and ends where the waveform falls below the
+// threshold again. If the waveform does not cross the threshold,
+// trigger is the number of samples and all other fields except the
+// baseline are 0
+struct PulseFeatures_t
+{
+    float    baseline;   // baseline in adc counts
+    float    amplitude;  // maximum of the pulse above the baseline in adc counts
+    uint32_t trigger;    // first sample above the threshold
+    uint32_t peak;       // sample of the maximum of the pulse
+    float    rise_time;  // 10-90% rise time in ns
+    float    tot;        // time over threshold in ns
+    float    tail_total; // charge after the tail delay over the total charge
+};
+
+/**
+ * Pulse shape features for pulse shape discrimination and detector
+ * studies. The features come from a few short loops over the
+ * waveform, while it is in the cache. The rise time is found
+ * going back from the maximum over the leading edge.
+ * The total charge is integrated from the trigger to the end of the
+ * record, the tail charge from tail_delay after the maximum, so
+ * pulses piled up after the first one are part of both.
+ * The rise time is taken from the raw samples with linear
+ * interpolation, so the noise should be small with respect to
+ * 10% of the amplitude.
+ */
+class PulseFeatureExtractor{
+
+  public:
+    /**
+     *
+     * @param : threshold     - threshold above the baseline in adc counts
+     * @param : tail_delay    - start of the tail charge after the maximum in ns
+     * @param : nbaseline     - number of pre-trigger samples for the baseline,
+     *                          0 for baseline corrected waveforms
+     * @param : sample_period - time between two samples in ns
+     * @param : baseline_mode - estimator for the baseline
+     */
+    PulseFeatureExtractor(float threshold = 50, int tail_delay = 200, int nbaseline = 1000,
+                          float sample_period = 4, BaselineMode baseline_mode = BaselineMode::Mean);
+
+    PulseFeatures_t extract(const int16_t* waveform, size_t nsamples) const;
+
+    /**
+     * The features of every waveform of a block (row major)
+     *
+     * @param : data         - nwaveforms*nsamples samples
+     * @param : nwaveforms   - number of waveforms (rows)
+     * @param : nsamples     - number of samples per waveform
+     * @param : features     - output, one entry per waveform
+     * @param : nthreads     - number of threads, 0 means one per core
+     */
+    void extract_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                       PulseFeatures_t* features, int nthreads = 0) const;
+
+  public:
+    float threshold;
+    int tail_delay;
+    int nbaseline;
+    float sample_period;
+    BaselineMode baseline_mode;
+};
+
+#endif
+
@@ -0,0 +1,91 @@
+#ifndef READOUT_BUFFER_POOL_H_INCLUDED
+#define READOUT_BUFFER_POOL_H_INCLUDED
+
+#include <vector>
+#include <mutex>
+#include <stdint.h>
+#include <cstddef>
+
+#include <CAENDigitizerType.h>
+#include <CAENDigitizer.h>
+
+/************************************************************************/
+
+// one readout buffer of the board together with the event and
+// waveform buffers to decode it, so every block can be decoded
+// independently of the others
+struct ReadoutBuffer_t
+{
+    char*                          buffer;         // CAEN_DGTZ_MallocReadoutBuffer
+    uint32_t                       size;           // bytes read into buffer
+    CAEN_DGTZ_DPP_PHA_Event_t*     events[8];      // CAEN_DGTZ_MallocDPPEvents, per channel
+    uint32_t                       num_events[8];  // events per channel in buffer
+    CAEN_DGTZ_DPP_PHA_Waveforms_t* waveform;       // CAEN_DGTZ_MallocDPPWaveforms
+};
+
+/************************************************************************/
+
+/**
+ * A fixed number of readout buffers, allocated once, which are handed
+ * out and given back through a free list. While one buffer is decoded,
+ * the board can already be read out into the next one. The buffers are
+ * handed out last in, first out, so a buffer which was just given back
+ * is likely still in the cache.
+ * acquire and release may be called from different threads.
+ */
+class ReadoutBufferPool {
+
+  public:
+    ReadoutBufferPool();
+    // the buffers are not freed (but leaked) if any of them is still in use
+    ~ReadoutBufferPool();
+
+    // the buffers are tied to the board, so the pool can not be copied
+    ReadoutBufferPool(const ReadoutBufferPool&) = delete;
+    ReadoutBufferPool& operator=(const ReadoutBufferPool&) = delete;
+
+    /**
+     * Allocate the buffers. This has to be done after the board is
+     * configured, since the size of the buffers depends on the
+     * configuration. Buffers allocated before are freed, which
+     * throws if any of them is still in use.
+     *
+     * @param : handle   - handle of the digitizer
+     * @param : nbuffers - number of buffers
+     */
+    void allocate(int handle, size_t nbuffers);
+
+    // free all buffers, throws if any of them is still in use
+    void free();
+
+    // a free buffer, nullptr if all of them are in use
+    ReadoutBuffer_t* acquire();
+
+    // give a buffer from acquire back
+    void release(ReadoutBuffer_t* buffer);
+
+    // number of buffers
+    size_t size() const;
+
+    // number of buffers which are not in use
+    size_t get_nfree();
+
+    // size of one readout buffer in bytes
+    uint32_t get_buffer_size() const;
+
+  private:
+    int handle_;
+    uint32_t buffer_size_;
+    std::vector<ReadoutBuffer_t> buffers_;
+    // the buffers not in use
+    std::vector<ReadoutBuffer_t*> free_;
+    std::mutex mutex_;
+
+    // throw if not all buffers are in the free list
+    void check_unused_() const;
+    // free all buffers, the mutex has to be held
+    void free_buffers_();
+};
+
+#endif
+
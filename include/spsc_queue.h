@@ -0,0 +1,72 @@
+#ifndef SPSC_QUEUE_H_INCLUDED
+#define SPSC_QUEUE_H_INCLUDED
+
+#include <atomic>
+#include <vector>
+#include <cstddef>
+
+/**
+ * Bounded lock-free queue between exactly one producer and one
+ * consumer thread, e.g. two stages of the readout pipeline. The
+ * items are kept in a ring, the producer only writes the tail and
+ * the consumer only the head, so neither push nor pop takes a lock.
+ * Meant for small items like pointers to buffers.
+ */
+template<typename T>
+class SPSCQueue{
+
+  public:
+    /**
+     *
+     * @param : capacity - maximum number of items in the queue
+     */
+    explicit SPSCQueue(size_t capacity) : slots_(capacity + 1),
+                                          head_(0),
+                                          tail_(0)
+    {}
+
+    // producer side, false if the queue is full
+    bool try_push(const T &item)
+    {
+      size_t tail = tail_.load(std::memory_order_relaxed);
+      size_t next = (tail + 1 == slots_.size()) ? 0 : tail + 1;
+      if (next == head_.load(std::memory_order_acquire)) return false;
+      slots_[tail] = item;
+      tail_.store(next, std::memory_order_release);
+      return true;
+    }
+
+    // consumer side, false if the queue is empty
+    bool try_pop(T &item)
+    {
+      size_t head = head_.load(std::memory_order_relaxed);
+      if (head == tail_.load(std::memory_order_acquire)) return false;
+      item = slots_[head];
+      head_.store((head + 1 == slots_.size()) ? 0 : head + 1, std::memory_order_release);
+      return true;
+    }
+
+    // number of items, only a snapshot if the other side is running
+    size_t size() const
+    {
+      size_t head = head_.load(std::memory_order_acquire);
+      size_t tail = tail_.load(std::memory_order_acquire);
+      return (tail >= head) ? tail - head : tail + slots_.size() - head;
+    }
+
+    size_t capacity() const
+    {
+      return slots_.size() - 1;
+    }
+
+  private:
+    // one slot stays empty to tell a full from an empty ring
+    std::vector<T> slots_;
+    // next slot to pop, written by the consumer only
+    alignas(64) std::atomic<size_t> head_;
+    // next slot to push, written by the producer only
+    alignas(64) std::atomic<size_t> tail_;
+};
+
+#endif
+
@@ -0,0 +1,77 @@
+#ifndef STREAMING_TRAPEZOID_H_INCLUDED
+#define STREAMING_TRAPEZOID_H_INCLUDED
+
+#include <vector>
+#include <stdint.h>
+#include <cstddef>
+
+/**
+ * The trapezoid of TrapezoidalFilter for a continuous stream of
+ * samples, which comes in chunks of arbitrary size, e.g. straight
+ * from the readout buffer. The filter state (the running window sum
+ * and the last 2*nramp + nflat samples) is kept across the chunks,
+ * so the memory does not grow with the length of the stream.
+ * The stream is cut into windows of a fixed number of samples, and
+ * the maximum of the trapezoid within each window is emitted as its
+ * energy as soon as the window is complete. If the windows are the
+ * records and the filter is reset at every record, the energies are
+ * the same as the ones of TrapezoidalFilter::shape_it.
+ */
+class StreamingTrapezoid{
+
+  public:
+    /**
+     *
+     * @param : ptime         - peaking time in ns
+     * @param : flat          - flat top in ns
+     * @param : window        - number of samples per energy
+     * @param : sample_period - time between two samples in ns
+     */
+    StreamingTrapezoid(int ptime, int flat = 1000, size_t window = 50000, float sample_period = 4);
+
+    /**
+     * Feed the next chunk of the stream.
+     *
+     * @param : samples      - the chunk
+     * @param : nsamples     - number of samples in the chunk
+     * @param : energies     - the energies of the windows completed
+     *                         with this chunk are appended here
+     * @return               - number of energies appended
+     */
+    size_t push(const int16_t* samples, size_t nsamples, std::vector<float> &energies);
+
+    /**
+     * Emit the energy of the incomplete last window, if there
+     * is one, and reset the filter
+     *
+     * @return               - number of energies appended (0 or 1)
+     */
+    size_t flush(std::vector<float> &energies);
+
+    // forget the stream, the next sample starts a new record
+    void reset();
+
+    // number of samples pushed since the last reset
+    uint64_t get_nsamples() const;
+
+  public:
+    int ptime;
+    int flat;
+    size_t window;
+    float sample_period;
+
+  private:
+    size_t nramp_;
+    size_t nflat_;
+    size_t ntot_;
+    // the last ntot_ samples, the oldest first. Before the
+    // stream has started these are zero
+    std::vector<int16_t> history_;
+    int64_t amp_sum_;
+    int64_t max_sum_;
+    uint64_t nseen_;
+    size_t nwindow_;
+};
+
+#endif
+
@@ -0,0 +1,100 @@
+#ifndef TILE_SCHEDULER_H_INCLUDED
+#define TILE_SCHEDULER_H_INCLUDED
+
+#include <vector>
+#include <stdint.h>
+#include <cstddef>
+
+#include "trapezoidal_shaper.h"
+#include "gaussian_shaper.h"
+
+// the shapers the TileScheduler can run
+enum class ShaperKind : int
+{
+    Trapezoid = 0, // TrapezoidalFilter, param is the flat top in ns
+    Gaussian  = 1  // GaussianShaper, param is the order
+};
+
+// one column of the output, a shaper with its peaking time
+struct ShaperSetting
+{
+    ShaperKind kind;
+    int ptime; // peaking time in ns
+    int param; // flat top (trapezoid) or order (gaussian)
+};
+
+// what happened to a tile
+struct TileStats_t
+{
+    uint32_t waveform;   // first waveform of the tile
+    uint32_t nwaveforms; // number of waveforms of the tile
+    uint32_t setting;    // first setting of the tile
+    uint32_t nsettings;  // number of settings of the tile
+    uint32_t worker;     // the thread which ran the tile
+    uint8_t  stolen;     // 1 if the tile was stolen from another thread
+    double   seconds;    // wall time of the tile
+    double   msamples_per_s; // shaped samples (waveform x setting) per second / 1e6
+};
+
+/**
+ * Shape a block of waveforms with a list of shaper settings (e.g.
+ * all peaking times of a sweep) in tiles. A tile is a block of
+ * waveforms which fits into the cache (cache_bytes), and a group
+ * of settings, which all run over the waveforms of the tile while
+ * they are still in the cache. This is the opposite of shaping the
+ * whole dataset once per peaking time, which streams everything
+ * through the memory for every peaking time.
+ * The tiles are distributed over a work-stealing pool: every thread
+ * starts with a contiguous range of tiles, and threads which run
+ * out steal tiles from the end of the ranges of the others. The
+ * time of every tile is recorded, so the scaling can be checked.
+ */
+class TileScheduler{
+
+  public:
+    /**
+     *
+     * @param : settings          - the shapers, one output column each
+     * @param : cache_bytes       - size of the waveform block of a tile, at least
+     *                              8 waveforms (the lanes of the gaussian shaper)
+     * @param : settings_per_tile - number of settings of a tile, 0 for all. Less
+     *                              settings give more tiles for a small dataset
+     * @param : sample_period     - time between two samples in ns
+     * @param : decay_time        - decay time of the pulses in ns (gaussian)
+     * @param : nbaseline         - number of baseline samples (gaussian)
+     */
+    TileScheduler(std::vector<ShaperSetting> const &settings, size_t cache_bytes = 1 << 20,
+                  size_t settings_per_tile = 0, float sample_period = 4,
+                  double decay_time = 80000, int nbaseline = 1000);
+
+    /**
+     * @param : data         - nwaveforms*nsamples samples (row major)
+     * @param : nwaveforms   - number of waveforms (rows)
+     * @param : nsamples     - number of samples per waveform
+     * @param : energies     - output, nwaveforms x settings.size() (row major)
+     * @param : stats        - output, one entry per tile
+     * @param : nthreads     - number of threads, 0 means one per core
+     */
+    void run(const int16_t* data, size_t nwaveforms, size_t nsamples, float* energies,
+             std::vector<TileStats_t> &stats, int nthreads = 0) const;
+
+  public:
+    std::vector<ShaperSetting> settings;
+    size_t cache_bytes;
+    size_t settings_per_tile;
+    float sample_period;
+    double decay_time;
+    int nbaseline;
+
+  private:
+    // the shaper of every setting, index into the vector of its kind
+    std::vector<TrapezoidalFilter> trapezoids_;
+    std::vector<GaussianShaper> gaussians_;
+    std::vector<size_t> shaper_index_;
+
+    void run_tile_(const int16_t* data, size_t nsamples, size_t nsettings_total,
+                   TileStats_t &tile, float* energies, std::vector<float> &buffer) const;
+};
+
+#endif
+
@@ -0,0 +1,60 @@
+#ifndef TRAPEZOIDAL_KERNELS_H_INCLUDED
+#define TRAPEZOIDAL_KERNELS_H_INCLUDED
+
+#include <stdint.h>
+#include <cstddef>
+
+/**
+ * The innermost loop of the trapezoidal filter. All kernels compute
+ * the running window sum
+ *
+ *    S(i) = sum_j (waveform[i-j] - waveform[i-j-nramp-nflat]), j in [0, nramp)
+ *
+ * for i in [2*nramp + nflat, nsamples) and return its maximum
+ * (but at least 0). The result is not yet divided by nramp.
+ *
+ * The vectorized kernels evaluate 8 (AVX2) or 16 (AVX-512) consecutive
+ * output samples per instruction. They take the int16 samples directly,
+ * form the 4-tap difference and integrate it with an in-register prefix
+ * sum. They are exact as long as nramp*65535 fits into 32 bit, for longer
+ * ramps the scalar kernel is used.
+ */
+typedef int64_t (*trapezoid_kernel_t)(const int16_t* waveform, size_t nsamples, int nramp, int nflat);
+
+int64_t trapezoid_max_scalar(const int16_t* waveform, size_t nsamples, int nramp, int nflat);
+int64_t trapezoid_max_avx2(const int16_t* waveform, size_t nsamples, int nramp, int nflat);
+int64_t trapezoid_max_avx512(const int16_t* waveform, size_t nsamples, int nramp, int nflat);
+
+// the scalar kernel for pre-decimated waveforms, where each
+// sample is the sum of several 16 bit samples
+int64_t trapezoid_max_int32(const int32_t* waveform, size_t nsamples, int nramp, int nflat);
+
+// the best kernel the cpu we are running on supports,
+// this is checked only once
+trapezoid_kernel_t select_trapezoid_kernel();
+
+// longest ramp (in samples) the 32 bit kernels can handle exactly
+const int MAX_SIMD_NRAMP = 32767;
+
+/**
+ * The integrated waveform, for evaluating many different peaking
+ * times on the same waveform,
+ *
+ *    cumsum[0] = 0, cumsum[k+1] = cumsum[k] + waveform[k]  (modulo 2^32)
+ *
+ * after which every window sum S(i) is just the combination of 4 
+ * entries of cumsum, independent of nramp and nflat,
+ *
+ *    S(i) = (cumsum[i+1] - cumsum[i+1-nramp]) - (cumsum[i+1-nramp-nflat] - cumsum[i+1-2*nramp-nflat])
+ *
+ * The wrap around of the unsigned arithmetic cancels as long as S(i)
+ * fits into 32 bit, which holds for nramp <= MAX_SIMD_NRAMP. cumsum
+ * has to hold nsamples + 1 entries.
+ */
+void cumulative_sum(const int16_t* waveform, size_t nsamples, uint32_t* cumsum);
+
+// "avx512", "avx2" or "scalar"
+const char* get_trapezoid_kernel_name();
+
+#endif
+
@@ -2,7 +2,11 @@
 #define TRAPEZOIDAL_SHAPER_H_INCLUDED
 
 #include <vector>
+#include <string>
 #include <stdint.h>
+#include <cstddef>
+
+#include "baseline.h"
 
 /**
  * Following up on Mengjiaos original implementation from 
@@ -12,6 +16,8 @@
  * falling part. 
  * Implemented here since even the vectorized version in numpy
  * seems to be a bit sluggish
+ * The filter only sees differences of samples, so it does not
+ * need the waveforms to be baseline corrected.
  */
 class TrapezoidalFilter{
 
@@ -21,15 +27,241 @@ class TrapezoidalFilter{
      * @param : ptime        - peaking/shaping time in ns
      * @param : flat         - flat top area
      * @param : recordlength - number of samples in the waveform  
+     * @param : sample_period - time between two samples in ns. This is 4ns 
+     *                          for the N6725, but 8ns in dual trace mode
+     *                          or more with the firmware decimation
+     * @param : decimation   - sum up blocks of this many samples before
+     *                         shaping, like the firmware decimation does.
+     *                         Note that the cost of the recursive filter
+     *                         does not depend on the peaking time, so
+     *                         this does not make it faster
+     */
+    TrapezoidalFilter(int ptime, int flat = 1000, int recordlength = 50000,
+                      float sample_period = 4, int decimation = 1); 
+    float shape_it(std::vector<int16_t> const &waveform) const;
+
+    /**
+     * Shape a whole block of waveforms at once. The waveforms are 
+     * expected to be stored contiguously, row by row, as in a 
+     * C-ordered 2D numpy array. The rows are distributed over
+     * a number of native threads.
+     *
+     * @param : data         - nwaveforms*nsamples samples
+     * @param : nwaveforms   - number of waveforms (rows)
+     * @param : nsamples     - number of samples per waveform
+     * @param : energies     - output, one energy per waveform
+     * @param : nthreads     - number of threads, 0 means one per core
      */
-    TrapezoidalFilter(int ptime, int flat = 1000, int recordlength = 50000); 
-    uint32_t shape_it(std::vector<int16_t> const &waveform) const;
+    void shape_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                     float* energies, int nthreads = 0) const;
+
+    // the name of the kernel in use, "avx512", "avx2" or "scalar"
+    static std::string get_kernel_name();
+
+    /**
+     * Write the full filter output for a block of waveforms into
+     * a buffer provided by the caller. Only every decimation-th
+     * sample is kept, so each trace has 
+     * get_trace_length(nsamples, decimation) samples. The filter
+     * output is 0 until the window fits into the waveform.
+     * The filter runs at the full sample rate here, independent
+     * of the decimation the filter was set up with.
+     *
+     * @param : data         - nwaveforms*nsamples samples (row major)
+     * @param : nwaveforms   - number of waveforms (rows)
+     * @param : nsamples     - number of samples per waveform
+     * @param : traces       - output, nwaveforms x trace length (row major)
+     * @param : decimation   - keep every decimation-th sample
+     * @param : nthreads     - number of threads, 0 means one per core
+     */
+    void shape_traces(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                      float* traces, size_t decimation = 1, int nthreads = 0) const;
+
+    static size_t get_trace_length(size_t nsamples, size_t decimation);
 
 
   public:
     int ptime;
     int flat;
     int recordlength;
+    float sample_period;
+    int decimation;
+
+  private:
+    // a time in ns in (decimated) samples, rounded to the nearest one
+    int to_samples_(int time, int decimation) const;
+
+    // the maximum of the filter output for a single waveform.
+    // The filter is computed recursively, so that the cost per
+    // sample does not depend on the peaking time. Uses the 
+    // SIMD kernel selected at runtime for this cpu. For 
+    // decimated waveforms the block sums go to buffer.
+    float shape_(const int16_t* waveform, size_t nsamples, std::vector<int32_t> &buffer) const;
+};
+
+/**
+ * Trapezoidal filter with pole-zero correction as it is implemented
+ * in the DPP-PHA firmware (Jordanov & Knoll, NIM A 345 (1994)).
+ * The exponentially decaying preamplifier pulses are turned into
+ * steps with the decay time constant (M), so that the flat top is 
+ * really flat. The energy is not the maximum of the filter, but
+ * the average of peak_mean samples taken flat_top_delay after the
+ * beginning of the flat top, as the firmware does it.
+ * All settings are the ones from the digitizer configuration (ChannelParams)
+ * and are computed recursively, so the cost does not depend on them.
+ */
+class PoleZeroTrapezoidalFilter{
+
+  public:
+    /**
+     *
+     * @param : rise            - trapezoid rise time (k) in ns
+     * @param : flat            - trapezoid flat top (m) in ns
+     * @param : decay           - input signal decay time (M) in ns
+     * @param : flat_top_delay  - delay of the energy sampling with respect to
+     *                            the beginning of the flat top (ftd) in ns
+     * @param : peak_mean       - number of samples averaged for the energy (nspk)
+     *                            firmware encoding, 0 : 1, 1 : 4, 2 : 16, 3 : 64 samples
+     * @param : nbaseline       - number of pre-trigger samples for the baseline,
+     *                            0 if the waveforms are already baseline corrected
+     * @param : baseline_mode   - estimator for the baseline
+     * @param : sample_period   - time between two samples in ns
+     */
+    PoleZeroTrapezoidalFilter(int rise, int flat, int decay, int flat_top_delay = 800, int peak_mean = 0,
+                              int nbaseline = 1000, BaselineMode baseline_mode = BaselineMode::Mean,
+                              float sample_period = 4); 
+    float shape_it(std::vector<int16_t> const &waveform) const;
+
+    // see TrapezoidalFilter::shape_batch
+    void shape_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                     float* energies, int nthreads = 0) const;
+
+  public:
+    int rise;
+    int flat;
+    int decay;
+    int flat_top_delay;
+    int peak_mean;
+    int nbaseline;
+    BaselineMode baseline_mode;
+    float sample_period;
+
+  private:
+    // the normalized trapezoid is written to trapezoid, which
+    // has to hold nsamples values
+    float shape_(const int16_t* waveform, size_t nsamples, float* trapezoid) const;
+};
+
+/**
+ * Integer version of the pole-zero corrected trapezoid, following
+ * the arithmetic of the DPP-PHA firmware as far as it is documented:
+ * integer baseline (mean over 4^(nsbl+1) samples, truncated), 
+ * integer decay constant M (in samples), the trapezoid rescaled
+ * by 2^-shf with shf = ceil(log2(k*M)) - 1 (the energy word has one
+ * bit more than the adc), the peak mean taken with a
+ * shift and the energy fine gain applied as 16 bit fraction. The 
+ * energy word is clipped to MAXNBITS bits, as the one in
+ * CAEN_DGTZ_DPP_PHA_Event_t::Energy.
+ * The intermediate values are all integers, so the results do not
+ * depend on the compiler or on the cpu. Whether they reproduce the 
+ * energies of the digitizer bit by bit has to be checked with data 
+ * recorded in mixed mode (waveform and energy).
+ */
+class FixedPointTrapezoidalFilter{
+
+  public:
+    // bits of the energy word, as CaenN6725DPPPHA::MAXNBITS_
+    static const int MAXNBITS = 15;
+
+    /**
+     *
+     * @param : rise                  - trapezoid rise time (k) in ns
+     * @param : flat                  - trapezoid flat top (m) in ns
+     * @param : decay                 - input signal decay time (M) in ns
+     * @param : flat_top_delay        - delay of the energy sampling with respect to
+     *                                  the beginning of the flat top (ftd) in ns
+     * @param : peak_mean             - number of samples averaged for the energy (nspk)
+     *                                  firmware encoding, 0 : 1, 1 : 4, 2 : 16, 3 : 64 samples
+     * @param : nsamples_baseline     - number of samples for the baseline (nsbl), firmware 
+     *                                  encoding 0 : none, 1 : 16, 2 : 64 ... 6 : 16384 samples 
+     * @param : energy_normalization  - energy fine gain (enf) 
+     * @param : sample_period         - time between two samples in ns
+     */
+    FixedPointTrapezoidalFilter(int rise, int flat, int decay, int flat_top_delay = 800, int peak_mean = 0,
+                                int nsamples_baseline = 2, float energy_normalization = 1.0,
+                                float sample_period = 4);
+    uint16_t shape_it(std::vector<int16_t> const &waveform) const;
+
+    // see TrapezoidalFilter::shape_batch
+    void shape_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                     uint16_t* energies, int nthreads = 0) const;
+
+  public:
+    int rise;
+    int flat;
+    int decay;
+    int flat_top_delay;
+    int peak_mean;
+    int nsamples_baseline;
+    float energy_normalization;
+    float sample_period;
+
+  private:
+    // the rescaled trapezoid is written to trapezoid, which
+    // has to hold nsamples values
+    uint16_t shape_(const int16_t* waveform, size_t nsamples, int64_t* trapezoid) const;
+};
+
+/**
+ * Energy from the flat top of the trapezoid instead of its maximum 
+ * over the whole record. A short trapezoid finds the trigger, and 
+ * the energy filter is only evaluated peak_mean samples at 
+ * flat_top_delay after the beginning of its flat top, like the 
+ * firmware does it. The maximum is biased upward by the noise, the
+ * average over the flat top is not. It also does not need to run
+ * over the part of the record after the pulse.
+ */
+class FlatTopTrapezoidalFilter{
+
+  public:
+    /**
+     *
+     * @param : ptime           - peaking time in ns
+     * @param : flat            - flat top in ns
+     * @param : flat_top_delay  - delay of the energy sampling with respect to
+     *                            the beginning of the flat top in ns
+     * @param : peak_mean       - number of samples averaged for the energy, 
+     *                            firmware encoding, 0 : 1, 1 : 4, 2 : 16, 3 : 64 samples
+     * @param : threshold       - trigger threshold on the fast filter in adc counts
+     * @param : fast_ptime      - peaking time of the fast (trigger) filter in ns
+     * @param : sample_period   - time between two samples in ns
+     */
+    FlatTopTrapezoidalFilter(int ptime, int flat = 1000, int flat_top_delay = 800, int peak_mean = 0,
+                             float threshold = 50, int fast_ptime = 100, float sample_period = 4);
+
+    // 0 if there is no trigger, or if the flat top is not
+    // within the record
+    float shape_it(std::vector<int16_t> const &waveform) const;
+
+    // see TrapezoidalFilter::shape_batch
+    void shape_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                     float* energies, int nthreads = 0) const;
+
+    // the sample where the fast filter first crosses the 
+    // threshold, nsamples if it does not
+    size_t find_trigger(const int16_t* waveform, size_t nsamples) const;
+
+  public:
+    int ptime;
+    int flat;
+    int flat_top_delay;
+    int peak_mean;
+    float threshold;
+    int fast_ptime;
+    float sample_period;
+
+  private:
+    float shape_(const int16_t* waveform, size_t nsamples) const;
 };
 
 #endif
@@ -0,0 +1,94 @@
+#ifndef TRIGGER_FINDER_H_INCLUDED
+#define TRIGGER_FINDER_H_INCLUDED
+
+#include <vector>
+#include <stdint.h>
+#include <cstddef>
+
+#include "baseline.h"
+
+// the discriminator of the TriggerFinder
+enum class TriggerMode : int
+{
+    LeadingEdge = 0, // the baseline subtracted waveform crosses the threshold
+    FastFilter  = 1, // zero crossing of the RC-CR2 filter, armed by its threshold
+    CFD         = 2  // constant fraction, armed by the leading edge threshold
+};
+
+/**
+ * Software trigger for stored waveforms, e.g. of the waveform
+ * firmware, which does not store a trigger position at all.
+ * All discriminators look for the first trigger of a waveform and
+ * return its sample index, or nsamples if the waveform does not
+ * trigger. A trigger needs the signal to come from below the
+ * threshold, so a waveform which starts on the tail of a previous
+ * pulse does not trigger right at its first sample.
+ *
+ * The RC-CR2 filter follows the trigger filter of the DPP-PHA
+ * firmware: the waveform is smoothed with a moving average (RC)
+ * of rc ns and differentiated twice (CR2) with the same time
+ * constant. The filter is bipolar, its zero crossing after the
+ * threshold is at the steepest point of the leading edge. For a
+ * step this is 3/2 rc after the step, which is subtracted, so that
+ * the trigger is the beginning of the pulse.
+ * The searches are done in blocks of samples, the test whether a
+ * block contains a trigger at all is vectorized by the compiler.
+ */
+class TriggerFinder{
+
+  public:
+    /**
+     *
+     * @param : mode          - the discriminator
+     * @param : threshold     - threshold in adc counts. For the FastFilter this
+     *                          is the amplitude of the RC-CR2 filter, for the
+     *                          others the one of the baseline subtracted waveform
+     * @param : rc            - time constant of the RC-CR2 filter in ns
+     * @param : cfd_fraction  - fraction of the constant fraction discriminator
+     * @param : cfd_delay     - delay of the constant fraction discriminator in ns
+     * @param : nbaseline     - number of pre-trigger samples for the baseline
+     *                          (LeadingEdge and CFD), 0 for baseline corrected
+     *                          waveforms
+     * @param : sample_period - time between two samples in ns
+     * @param : baseline_mode - estimator for the baseline
+     */
+    TriggerFinder(TriggerMode mode = TriggerMode::FastFilter, float threshold = 50, int rc = 100,
+                  float cfd_fraction = 0.5, int cfd_delay = 100, int nbaseline = 1000,
+                  float sample_period = 4, BaselineMode baseline_mode = BaselineMode::Mean);
+
+    // the first trigger of a single waveform, nsamples if there is none
+    size_t find_trigger(const int16_t* waveform, size_t nsamples) const;
+
+    /**
+     * The first trigger of every waveform of a block (row major)
+     *
+     * @param : data         - nwaveforms*nsamples samples
+     * @param : nwaveforms   - number of waveforms (rows)
+     * @param : nsamples     - number of samples per waveform
+     * @param : triggers     - output, one sample index per waveform,
+     *                         nsamples if the waveform did not trigger
+     * @param : nthreads     - number of threads, 0 means one per core
+     */
+    void find_triggers(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                       uint32_t* triggers, int nthreads = 0) const;
+
+  public:
+    TriggerMode mode;
+    float threshold;
+    int rc;
+    float cfd_fraction;
+    int cfd_delay;
+    int nbaseline;
+    float sample_period;
+    BaselineMode baseline_mode;
+
+  private:
+    size_t leading_edge_(const int16_t* waveform, size_t nsamples, float baseline) const;
+    size_t cfd_(const int16_t* waveform, size_t nsamples, float baseline) const;
+    // the RC-CR2 filter output goes to the buffer (nsamples values)
+    size_t fast_filter_(const int16_t* waveform, size_t nsamples, std::vector<int32_t> &buffer) const;
+    size_t find_trigger_(const int16_t* waveform, size_t nsamples, std::vector<int32_t> &buffer) const;
+};
+
+#endif
+
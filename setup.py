@@ -226,6 +226,17 @@ ext_modules = [
     CMakeExtension(
         'Dactylos',
         sources = ['src/trapezoidal_shaper.cxx',
+                   'src/trapezoidal_kernels.cxx',
+                   'src/gaussian_shaper.cxx',
+                   'src/baseline.cxx',
+                   'src/pileup_rejector.cxx',
+                   'src/streaming_trapezoid.cxx',
+                   'src/trigger_finder.cxx',
+                   'src/pulse_features.cxx',
+                   'src/enc_scan.cxx',
+                   'src/tile_scheduler.cxx',
+                   'src/noise_psd.cxx',
+                   'src/readout_buffer_pool.cxx',
                    'src/CaenN6725.cxx'],
         include_dirs=[
             # Path to pybind11 headers
@@ -1,6 +1,9 @@
 #include <stdexcept>
 #include <fstream>
 #include <cmath>
+#include <thread>
+#include <chrono>
+#include <algorithm>
 
 #include <CAENDigitizerType.h>
 #include <CAENDigitizer.h>
@@ -1243,10 +1246,23 @@ CAEN_DGTZ_ErrorCode CaenN6725DPPPHA::get_last_error() const
 
 /***************************************************************/
 
+void CaenN6725DPPPHA::reserve_traces_()
+{
+    size_t nsamples = std::max(recordlength_, 0);
+    analog_trace1_.reserve(nsamples);
+    analog_trace2_.reserve(nsamples);
+    digital_trace1_.reserve(nsamples);
+    digital_trace2_.reserve(nsamples);
+    for (auto &waveform : waveform_ch_)
+        {waveform.reserve(nsamples);}
+}
+
+/***************************************************************/
+
 inline void CaenN6725DPPPHA::fill_analog_trace1_()
 {
     atrace1_ = waveform_->Trace1;
-    analog_trace1_ = std::vector<int16_t>(atrace1_, atrace1_ + trace_ns_);
+    analog_trace1_.assign(atrace1_, atrace1_ + trace_ns_);
 }
 
 /***************************************************************/
@@ -1254,7 +1270,7 @@ inline void CaenN6725DPPPHA::fill_analog_trace1_()
 inline void CaenN6725DPPPHA::fill_analog_trace2_()
 {
     atrace2_ = waveform_->Trace2;
-    analog_trace2_ = std::vector<int16_t>(atrace2_, atrace2_ + trace_ns_);
+    analog_trace2_.assign(atrace2_, atrace2_ + trace_ns_);
 }
 
 /***************************************************************/
@@ -1262,7 +1278,7 @@ inline void CaenN6725DPPPHA::fill_analog_trace2_()
 inline void CaenN6725DPPPHA::fill_digital_trace1_()
 {
     dtrace1_ = waveform_->DTrace1;
-    digital_trace1_ = std::vector<uint8_t>(dtrace1_, dtrace1_ + trace_ns_);
+    digital_trace1_.assign(dtrace1_, dtrace1_ + trace_ns_);
 }
 
 /***************************************************************/
@@ -1270,7 +1286,7 @@ inline void CaenN6725DPPPHA::fill_digital_trace1_()
 inline void CaenN6725DPPPHA::fill_digital_trace2_()
 {
     dtrace2_ = waveform_->DTrace2;
-    digital_trace2_ = std::vector<uint8_t>(dtrace2_, dtrace2_ + trace_ns_);
+    digital_trace2_.assign(dtrace2_, dtrace2_ + trace_ns_);
 }
 
 /***************************************************************/
@@ -1295,27 +1311,27 @@ CAEN_DGTZ_BoardInfo_t CaenN6725DPPPHA::get_board_info()
 
 /***************************************************************/
 
-std::vector<int16_t> CaenN6725DPPPHA::get_analog_trace1()
+const std::vector<int16_t>& CaenN6725DPPPHA::get_analog_trace1() const
 {
     return analog_trace1_;
 }
 /***************************************************************/
 
-std::vector<int16_t> CaenN6725DPPPHA::get_analog_trace2()
+const std::vector<int16_t>& CaenN6725DPPPHA::get_analog_trace2() const
 {
     return analog_trace2_;
 }
 
 /***************************************************************/
 
-std::vector<uint8_t> CaenN6725DPPPHA::get_digital_trace1()
+const std::vector<uint8_t>& CaenN6725DPPPHA::get_digital_trace1() const
 {
     return digital_trace1_;
 }
 
 /***************************************************************/
 
-std::vector<uint8_t> CaenN6725DPPPHA::get_digital_trace2()
+const std::vector<uint8_t>& CaenN6725DPPPHA::get_digital_trace2() const
 {
     return digital_trace2_;
 }
@@ -1360,15 +1376,16 @@ void CaenN6725DPPPHA::allocate_memory()
     //current_error_ = CAEN_DGTZ_SetPostTriggerSize(handle_, posttrigs);
     //if (current_error_ !=0 ) throw std::runtime_error("Setting the post trigger size failed! err code:" + std::to_string(current_error_));
     //if (!configured_) throw std::runtime_error("ERROR: The mallocs MUST be done after the digitizer programming because the following functions needs to know the digitizer configuration to allocate the right memory amount");
-    current_error_ = CAEN_DGTZ_MallocReadoutBuffer(handle_, &buffer_, &allocated_size_);
-    if (current_error_ != 0) throw std::runtime_error("Error while allocating readout buffer, err code " + std::to_string(current_error_));
-    /* Allocate memory for the events */
-    current_error_ = CAEN_DGTZ_MallocDPPEvents(handle_, (void**)(events_), &allocated_size_);
-    if (current_error_ != 0) throw std::runtime_error("Error while allocating DPP event buffer, err code " + std::to_string(current_error_));
-    /* Allocate memory for the waveforms */
-    current_error_ = CAEN_DGTZ_MallocDPPWaveforms(handle_, (void**)(&waveform_), &allocated_size_);
-    if (current_error_ != 0) throw std::runtime_error("Error while allocating DPP waveform buffer, err code " + std::to_string(current_error_));
-
+    // the readout buffers, each with its own memory
+    // for the events and the waveforms
+    pool_.allocate(handle_, pipeline_depth_);
+    allocated_size_ = pool_.get_buffer_size();
+    // read_block_ fills these per channel, also if start_acquisition
+    // was not called. The tree branches point into them, so they are
+    // only grown, never shrunk
+    size_t nchan = get_nchannels();
+    if (energy_ch_.size()   < nchan) energy_ch_.resize(nchan, 0);
+    if (waveform_ch_.size() < nchan) waveform_ch_.resize(nchan);
 }
 
 /***************************************************************/
@@ -1380,17 +1397,29 @@ uint32_t CaenN6725DPPPHA::get_allocated_buffer_size()
 
 /***************************************************************/
 
-std::vector<std::vector<CAEN_DGTZ_DPP_PHA_Event_t>> CaenN6725DPPPHA::read_data(bool fill_histogram)
+CaenN6725DPPPHA::ReadoutGuard_::ReadoutGuard_(std::atomic<bool> &running) : running(running)
+{
+    bool expected = false;
+    if (!running.compare_exchange_strong(expected, true))
+        throw std::runtime_error("A readout is running already, read_data, continuous_readout and set_pipeline_depth can not be called at the same time!");
+}
+
+/***************************************************************/
+
+CaenN6725DPPPHA::ReadoutGuard_::~ReadoutGuard_()
+{
+    running = false;
+}
+
+/***************************************************************/
+
+template<typename Func>
+bool CaenN6725DPPPHA::read_block_(bool fill_histogram, Func on_event)
 {
-    // check the readout status
-    uint32_t acqstatus;
+    ReadoutGuard_ guard(readout_running_);
+    // check the readout status, the 3rd bit is the acquisition status
     // fixme: maybe 0xEF04 is better since it is dpp_pha? (event_ready)
-    current_error_ = CAEN_DGTZ_ReadRegister(handle_, 0x8104, &acqstatus);
-    while (! ( acqstatus & (1 << 3))) // the 3rd bit is the acquisition status
-        {
-            // nothing to readout
-            current_error_ = CAEN_DGTZ_ReadRegister(handle_, 0x8104, &acqstatus);
-        }
+    wait_for_data_(1 << 3, -1);
 
     //if (! ( acqstatus && (1 << 4))) // the 3rd bit is the acquisition status
     //    {
@@ -1401,48 +1430,45 @@ std::vector<std::vector<CAEN_DGTZ_DPP_PHA_Event_t>> CaenN6725DPPPHA::read_data(b
     for (int k = 0; k<get_nchannels(); k++)
         {num_events_[k] = 0;}
 
-    std::vector<CAEN_DGTZ_DPP_PHA_Event_t> channel_events;
-    std::vector<std::vector<CAEN_DGTZ_DPP_PHA_Event_t>> thisevents;
-    current_error_ = CAEN_DGTZ_ReadData(handle_, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, buffer_, &buffer_size_);
+    ReadoutBuffer_t* block = pool_.acquire();
+    if (!block) throw std::runtime_error("No free readout buffer, allocate_memory has to be called first!");
+    current_error_ = CAEN_DGTZ_ReadData(handle_, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, block->buffer, &block->size);
     if (current_error_ != 0) 
         {
             std::cout << "error while reading data" << current_error_ << std::endl;
-            return thisevents;
+            pool_.release(block);
+            return false;
         }
-    if (buffer_size_ == 0)
+    if (block->size == 0)
         {
-            return thisevents;
+            pool_.release(block);
+            return false;
         }
 
     //if (current_error_ != 0) throw std::runtime_error("Error while reading data from the digitizer, err code " + std::to_string(current_error_));
-    current_error_ =  CAEN_DGTZ_GetDPPEvents(handle_, buffer_, buffer_size_, (void**)(events_),num_events_);
+    current_error_ =  CAEN_DGTZ_GetDPPEvents(handle_, block->buffer, block->size, (void**)(block->events),num_events_);
 
     if (current_error_ != 0)
         {
             std::cout << "error while getting DPP events" << current_error_ << std::endl;
-            return thisevents;
+            pool_.release(block);
+            return false;
         }
+    // the traces are filled from this one
+    waveform_ = block->waveform;
 
     if (root_file_) root_file_->cd();
 
     for (int ch=0;ch<get_nchannels();ch++)
         {
-            channel_events = {};
-            if (decode_waveforms_)
-                {
-                    waveform_ch_.clear();
-                    for (int k=0;k<8;k++)
-                        {waveform_ch_.push_back({});}
-                }
-    
             for (int ev=0;ev<num_events_[ch];ev++)
                 {
-                    channel_events.push_back(events_[ch][ev]);
-                    energy_ch_[ch] = events_[ch][ev].Energy;
-                    energy_        = events_[ch][ev].Energy;
+                    on_event(ch, block->events[ch][ev]);
+                    energy_ch_[ch] = block->events[ch][ev].Energy;
+                    energy_        = block->events[ch][ev].Energy;
                     if (fill_histogram)
                         {
-                            if (energy_ > 16384) 
+                            if (energy_ >= 16384) 
                                 {
                                     fail_events_[ch] += 1;
                                 } else {
@@ -1452,13 +1478,14 @@ std::vector<std::vector<CAEN_DGTZ_DPP_PHA_Event_t>> CaenN6725DPPPHA::read_data(b
                         }
                     if (decode_waveforms_)
                         {
-                            CAEN_DGTZ_DecodeDPPWaveforms(handle_, &events_[ch][ev], waveform_);
+                            CAEN_DGTZ_DecodeDPPWaveforms(handle_, &block->events[ch][ev], waveform_);
                             trace_ns_ = waveform_->Ns;
                             fill_analog_trace1_();
                             fill_analog_trace2_();
                             fill_digital_trace1_();
                             fill_digital_trace2_();
-                            waveform_ch_.at(ch) = get_analog_trace1();
+                            // the tree branch points to this one
+                            waveform_ch_[ch].assign(atrace1_, atrace1_ + trace_ns_);
                             //channel_trees_[ch]->Write();
                             //++traceId;
                         }
@@ -1470,17 +1497,49 @@ std::vector<std::vector<CAEN_DGTZ_DPP_PHA_Event_t>> CaenN6725DPPPHA::read_data(b
                     channel_trees_[ch]->Write();
                     n_events_acq_[ch] += num_events_[ch]; 
                 }
-            thisevents.push_back(channel_events);
         }
-    //CAEN_DGTZ_DPP_PHA_Event_t (*thisevents)[]
+    pool_.release(block);
+    return true;
+}
+
+/***************************************************************/
+
+std::vector<std::vector<CAEN_DGTZ_DPP_PHA_Event_t>> CaenN6725DPPPHA::read_data(bool fill_histogram)
+{
+    std::vector<std::vector<CAEN_DGTZ_DPP_PHA_Event_t>> thisevents(get_nchannels());
+    bool has_data = read_block_(fill_histogram, [&](int ch, const CAEN_DGTZ_DPP_PHA_Event_t &event) {
+        thisevents[ch].push_back(event);
+    });
+    if (!has_data) thisevents.clear();
     return thisevents;
 }
 
 /***************************************************************/
 
-std::vector<int16_t> CaenN6725DPPPHA::get_last_waveform(int channel)
+bool CaenN6725DPPPHA::read_data_records(bool fill_histogram)
 {
-    return waveform_ch_[channel];
+    // clear keeps the capacity
+    for (auto &records : event_records_)
+        {records.clear();}
+    return read_block_(fill_histogram, [&](int ch, const CAEN_DGTZ_DPP_PHA_Event_t &event) {
+        event_records_[ch].push_back({event.TimeTag, event.Energy, event.Extras, event.Extras2});
+    });
+}
+
+/***************************************************************/
+
+const std::vector<DPPEventRecord_t>& CaenN6725DPPPHA::get_event_records(int channel) const
+{
+    if ((channel < 0) || (channel >= get_nchannels()))
+        {throw std::runtime_error("Can not identify channel " + std::to_string(channel));}
+    return event_records_[channel];
+}
+
+/***************************************************************/
+
+const std::vector<int16_t>& CaenN6725DPPPHA::get_last_waveform(int channel) const
+{
+    return waveform_ch_.at(channel);
 }
 
 
@@ -1520,92 +1579,170 @@ std::vector<long> CaenN6725DPPPHA::get_n_lost_triggers_tot()
 
 /***************************************************************/
 
-void CaenN6725DPPPHA::fast_readout_()
+void CaenN6725DPPPHA::readout_stage_(unsigned int seconds,
+                                     SPSCQueue<ReadoutBuffer_t*> &filled,
+                                     std::atomic<bool> &done)
 {
-    // check the readout status
-    uint32_t acqstatus;
-    
-    current_error_ = CAEN_DGTZ_ReadRegister(handle_, 0x8104, &acqstatus);
-    if (! ( acqstatus & (1 << 3))) // the 3rd bit is the acquisition status
-        {
-            return; // nothing to readout
-        }
-    // wait till the buffer is full
-    if (! ( acqstatus & (1 << 4))) // the 3rd bit is the acquisition status
+    // the errors are local, the stages run concurrently
+    CAEN_DGTZ_ErrorCode err;
+    PipelineStats_t &stats = pipeline_stats_[0];
+    ReadoutBuffer_t* block = nullptr;
+    // the buffers come back at the pace of the decoding, so
+    // wait for them with the same backoff as for the data
+    unsigned int backoff_us = 0;
+    long start_time = get_time();
+    long now_time   = start_time;
+    while (now_time - start_time < 1000*(long)seconds)
         {
-            return; // no channel in full status
+            now_time = get_time();
+            // without a free buffer the data has to stay on the board
+            if (!block)
+                {
+                    block = pool_.acquire();
+                    if (!block)
+                        {
+                            if (backoff_us == 0) stats.nfull++;
+                            backoff_us = std::min(std::max(2*backoff_us, 1u), max_backoff_us_);
+                            std::this_thread::sleep_for(std::chrono::microseconds(backoff_us));
+                            continue;
+                        }
+                    backoff_us = 0;
+                }
+            // the 3rd bit is the acquisition status, the 4th is
+            // set when a channel is in full status
+            if (!wait_for_data_((1 << 3) | (1 << 4), 1000*(long)seconds - (now_time - start_time)))
+                {
+                    continue;
+                }
+            err = CAEN_DGTZ_ReadData(handle_, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, block->buffer, &block->size);
+            if (err != 0) 
+                {
+                    std::cout << "error while reading data" << err << std::endl;
+                    continue;
+                }
+            if (block->size == 0)
+                {
+                    continue;
+                }
+            // there are not more buffers than slots, so this
+            // can not fail
+            filled.try_push(block);
+            block = nullptr;
+            uint32_t depth = filled.size();
+            stats.nblocks++;
+            stats.max_depth   = std::max(stats.max_depth, depth);
+            stats.mean_depth += depth;
         }
-    for (int k = 0; k<get_nchannels(); k++)
-        {num_events_[k] = 0;}
+    if (block) pool_.release(block);
+    done.store(true, std::memory_order_release);
+}
 
-    current_error_ = CAEN_DGTZ_ReadData(handle_, CAEN_DGTZ_SLAVE_TERMINATED_READOUT_MBLT, buffer_, &buffer_size_);
-    if (current_error_ != 0) 
-        {
-            std::cout << "error while reading data" << current_error_ << std::endl;
-            return;
-        }
-    if (buffer_size_ == 0)
-        {
-            return;
-        }
-    //if (current_error_ != 0) throw std::runtime_error("Error while reading data from the digitizer, err code " + std::to_string(current_error_));
-    current_error_ =  CAEN_DGTZ_GetDPPEvents(handle_, buffer_, buffer_size_, (void**)(events_),num_events_);
-    if (current_error_ != 0)
+/***************************************************************/
+
+void CaenN6725DPPPHA::decode_stage_(SPSCQueue<ReadoutBuffer_t*> &filled,
+                                    SPSCQueue<DecodedBlock_t*> &free_blocks,
+                                    SPSCQueue<DecodedBlock_t*> &decoded,
+                                    std::atomic<bool> &readout_done,
+                                    std::atomic<bool> &done)
+{
+    // every readout buffer comes with its own event
+    // and waveform buffers to decode it
+    CAEN_DGTZ_ErrorCode err;
+    PipelineStats_t &in_stats  = pipeline_stats_[0];
+    PipelineStats_t &out_stats = pipeline_stats_[1];
+    ReadoutBuffer_t* raw;
+    DecodedBlock_t* block;
+    // the waits are counted once, not every look at the queue
+    bool waiting = false;
+    while (true)
         {
-            std::cout << "error while getting DPP data" << current_error_ << std::endl;
-            return;
+            // check the flag before the queue, so nothing can
+            // arrive after the queue was found empty
+            bool finished = readout_done.load(std::memory_order_acquire);
+            if (!filled.try_pop(raw))
+                {
+                    if (finished) break;
+                    if (!waiting) in_stats.nempty++;
+                    waiting = true;
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                    continue;
+                }
+            waiting = false;
+            err = CAEN_DGTZ_GetDPPEvents(handle_, raw->buffer, raw->size, (void**)(raw->events), raw->num_events);
+            if (err != 0)
+                {
+                    std::cout << "error while getting DPP data" << err << std::endl;
+                    pool_.release(raw);
+                    continue;
+                }
+            if (!free_blocks.try_pop(block))
+                {
+                    out_stats.nfull++;
+                    do
+                        {std::this_thread::sleep_for(std::chrono::microseconds(50));}
+                    while (!free_blocks.try_pop(block));
+                }
+            decode_readout_buffer(handle_, raw, block, active_channel_bitmask_, decode_waveforms_);
+            // the encoded waveforms point into the readout buffer,
+            // so it can only be given back now
+            pool_.release(raw);
+            decoded.try_push(block);
+            uint32_t depth = decoded.size();
+            out_stats.nblocks++;
+            out_stats.max_depth   = std::max(out_stats.max_depth, depth);
+            out_stats.mean_depth += depth;
         }
+    done.store(true, std::memory_order_release);
+}
+
+/***************************************************************/
 
+void CaenN6725DPPPHA::write_stage_(SPSCQueue<DecodedBlock_t*> &decoded,
+                                   SPSCQueue<DecodedBlock_t*> &free_blocks,
+                                   std::atomic<bool> &decode_done)
+{
+    // the trees and the branch addresses belong to this stage
+    // while the pipeline is running
+    PipelineStats_t &stats = pipeline_stats_[1];
+    DecodedBlock_t* block;
+    bool waiting = false;
+    // the current directory is per thread
     if (root_file_) root_file_->cd();
-    if (decode_waveforms_)
-      {
-        waveform_ch_.clear();
-        waveform_ch_.reserve(get_nchannels());
-        //trigger_ch_ = std::vector<int>(8,0);
-        trigger_ch_.clear();
-        trigger_ch_.reserve(get_nchannels());
-        saturated_ch_.clear();
-        saturated_ch_.reserve(get_nchannels());
-
-        for (int k=0; k<get_nchannels(); k++)
-            {waveform_ch_.push_back({});
-             trigger_ch_.push_back(-1);
-             saturated_ch_.push_back(0);}
-      }
-    for (int ch=0;ch<get_nchannels();ch++)
-      {
-        if (!(is_active(ch))) continue;
-        for (int ev=0;ev<num_events_[ch];ev++)
-          {
-            // this is ok, because the energy gets then
-            // written to the root file imediatly
-            energy_ch_[ch] = events_[ch][ev].Energy;
-            if (events_[ch][ev].Extras & (1<<4))
-                    {saturated_ch_[ch] = 1;}
-            //energy_        = events_[ch][ev].Energy;
-            if (decode_waveforms_)
-              {
-                  CAEN_DGTZ_DecodeDPPWaveforms(handle_, &events_[ch][ev], waveform_);
-                  // fast mode, only do trace1
-                  trace_ns_ = waveform_->Ns;
-                  // set the saturated flag if saturated
-                  fill_analog_trace1_();
-                  fill_digital_trace2_();
-                  trigger_ch_.at(ch)  = get_trigger_point(); 
-                  //std::cout << get_trigger_point() << std::endl;
-                  waveform_ch_.at(ch) = get_analog_trace1();
-                  channel_trees_[ch]->Fill();
-              }
-            else 
-              {
-                  channel_trees_[ch]->Fill();
-              }
-          }
-        //channel_trees_[ch]->Fill();
-        channel_trees_[ch]->Write();
-        n_events_acq_[ch] += num_events_[ch];
-      }
-    return;
+    while (true)
+        {
+            bool finished = decode_done.load(std::memory_order_acquire);
+            if (!decoded.try_pop(block))
+                {
+                    if (finished) break;
+                    if (!waiting) stats.nempty++;
+                    waiting = true;
+                    std::this_thread::sleep_for(std::chrono::microseconds(50));
+                    continue;
+                }
+            waiting = false;
+            for (int ch=0;ch<get_nchannels();ch++)
+                {
+                    if (!(is_active(ch))) continue;
+                    size_t nevents = block->energy[ch].size();
+                    const int16_t* trace = block->waveforms[ch].data();
+                    for (size_t ev=0;ev<nevents;ev++)
+                        {
+                            energy_ch_[ch]    = block->energy[ch][ev];
+                            saturated_ch_[ch] = block->saturated[ch][ev];
+                            if (decode_waveforms_)
+                                {
+                                    uint32_t ns = block->nsamples[ch][ev];
+                                    waveform_ch_[ch].assign(trace, trace + ns);
+                                    trigger_ch_[ch] = block->trigger[ch][ev];
+                                    trace += ns;
+                                }
+                            channel_trees_[ch]->Fill();
+                        }
+                    if (root_file_) channel_trees_[ch]->Write();
+                    n_events_acq_[ch] += nevents;
+                }
+            free_blocks.try_push(block);
+        }
 }
 
 /***************************************************************/
@@ -1749,15 +1886,14 @@ void CaenN6725DPPPHA::start_acquisition()
          if (!root_file_) throw std::runtime_error("Problems with root file " + rootfile_name_);
         }
     channel_trees_.clear();
-    energy_ch_.clear();
-    waveform_ch_.clear();
-    trigger_ch_.clear();
-    saturated_ch_.clear();
-    energy_ch_.reserve(8);
-    waveform_ch_.reserve(8);
     channel_trees_.reserve(8);
-    trigger_ch_.reserve(8);
-    saturated_ch_.reserve(8);
+    // the branches point into these, so they have to have
+    // their final size before the trees are set up
+    energy_ch_    = std::vector<uint16_t>(8, 0);
+    waveform_ch_  = std::vector<std::vector<int16_t>>(8);
+    trigger_ch_   = std::vector<int>(8, -1);
+    saturated_ch_ = std::vector<uint8_t>(8, 0);
+    reserve_traces_();
     std::string ch_name = "ch";
     for (int k=0;k<8;k++)
         {
@@ -1837,6 +1973,7 @@ void CaenN6725DPPPHA::set_channel_trigger_threshold(int channel, int threshold)
 
 void CaenN6725DPPPHA::continuous_readout(unsigned int seconds)
 {
+    ReadoutGuard_ guard(readout_running_);
     // this is meant for fast continueous readout
     // set second vprobe to None, so we get the full 
     // sampling rate for the waveform
@@ -1855,29 +1992,170 @@ void CaenN6725DPPPHA::continuous_readout(unsigned int seconds)
     //        if (current_error_ !=0 ) throw std::runtime_error("Can not set DPP acquisition mode err code:" + std::to_string(current_error_));
 
     //    }
-    long now_time = get_time()/1000;
-    long last_time = now_time;
-    long delta_t = 0;
-    //GProgressBar progress(seconds);
-    int progress_step = 0;
-    int last_progress_step = 0;
+    pipeline_stats_ = std::vector<PipelineStats_t>(2);
+    pipeline_stats_[0].queue = "readout->decode";
+    pipeline_stats_[1].queue = "decode->write";
+
+    // the readout buffers come from the pool, and there are as
+    // many blocks for the decoded events. The blocks go round
+    // through a free queue, so the queues between the stages
+    // can never overflow
+    size_t nbuffers = pool_.size();
+    if (nbuffers == 0) throw std::runtime_error("No readout buffers, allocate_memory has to be called first!");
+    std::vector<DecodedBlock_t> blocks(nbuffers);
+    SPSCQueue<ReadoutBuffer_t*> filled(nbuffers);
+    SPSCQueue<DecodedBlock_t*>  free_blocks(nbuffers);
+    SPSCQueue<DecodedBlock_t*>  decoded(nbuffers);
+    for (auto &block : blocks)
+        {free_blocks.try_push(&block);}
+
+    std::atomic<bool> readout_done(false);
+    std::atomic<bool> decode_done(false);
     std::cout << "Starting readout" << std::endl;
-    while (delta_t < seconds)
+    std::thread decoder(&CaenN6725DPPPHA::decode_stage_, this, std::ref(filled), std::ref(free_blocks),
+                        std::ref(decoded), std::ref(readout_done), std::ref(decode_done));
+    std::thread writer(&CaenN6725DPPPHA::write_stage_, this, std::ref(decoded), std::ref(free_blocks),
+                       std::ref(decode_done));
+    // the calling thread drains the board
+    readout_stage_(seconds, filled, readout_done);
+    decoder.join();
+    writer.join();
+    for (auto &stats : pipeline_stats_)
+        {
+            if (stats.nblocks > 0) stats.mean_depth /= stats.nblocks;
+        }
+}
+
+/*******************************************************************/
+
+bool CaenN6725DPPPHA::wait_for_data_(uint32_t status_mask, long timeout_ms)
+{
+    CAEN_DGTZ_ErrorCode err;
+    uint32_t acqstatus  = 0;
+    unsigned int backoff_us = 1;
+    // the interrupt is raised as soon as one event is ready and stays
+    // until the data is read (RORA). Waiting for more than the event
+    // ready bit would make every IRQWait return at once
+    if (wait_policy_ == WaitPolicy::IRQ) status_mask = (1 << 3);
+    // counted here and added to the statistics once per wait,
+    // get_wait_stats may be called from another thread
+    uint64_t npolls(0), nirqs(0);
+    bool ready;
+    auto start    = std::chrono::steady_clock::now();
+    auto deadline = start + std::chrono::milliseconds(std::max(timeout_ms, 0L));
+    auto now      = start;
+    while (true)
         {
-            fast_readout_();
-            now_time = get_time()/1000;
-            delta_t +=  now_time  - last_time;
-            last_time = now_time;
-            progress_step += delta_t;
-            if (progress_step - last_progress_step > 5)
+            err = CAEN_DGTZ_ReadRegister(handle_, 0x8104, &acqstatus);
+            npolls++;
+            now = std::chrono::steady_clock::now();
+            ready = (err == 0) && ((acqstatus & status_mask) == status_mask);
+            if (ready || ((timeout_ms >= 0) && (now >= deadline)))
+                {break;}
+            switch (wait_policy_)
                 {
-                    //for (int j=0; j<5;j++)
-                    //    {++progress;}
-                    last_progress_step = progress_step;
+                    case WaitPolicy::Poll:
+                        break;
+                    case WaitPolicy::Backoff:
+                        std::this_thread::sleep_for(std::chrono::microseconds(backoff_us));
+                        backoff_us = std::min(2*backoff_us, max_backoff_us_);
+                        break;
+                    case WaitPolicy::IRQ:
+                        {
+                            // the board might already have data, so do not
+                            // sleep longer than irq_timeout_ms without a look
+                            long irq_timeout = irq_timeout_ms_;
+                            if (timeout_ms >= 0)
+                                {
+                                    long left = std::chrono::duration_cast<std::chrono::milliseconds>(deadline - now).count();
+                                    irq_timeout = std::max(1L, std::min(irq_timeout, left));
+                                }
+                            if (CAEN_DGTZ_IRQWait(handle_, irq_timeout) == CAEN_DGTZ_Success)
+                                {nirqs++;}
+                            break;
+                        }
                 }
         }
+    std::lock_guard<std::mutex> lock(wait_stats_mutex_);
+    wait_stats_.nwaits++;
+    wait_stats_.npolls += npolls;
+    wait_stats_.nirqs  += nirqs;
+    if (ready)
+        {
+            double wait_us = std::chrono::duration<double, std::micro>(now - start).count();
+            wait_us_total_ += wait_us;
+            wait_stats_.max_wait_us = std::max(wait_stats_.max_wait_us, wait_us);
+        }
+    else
+        {wait_stats_.ntimeouts++;}
+    return ready;
 }
 
+/*******************************************************************/
+
+void CaenN6725DPPPHA::set_wait_policy(WaitPolicy policy, unsigned int max_backoff_us,
+                                      unsigned int irq_timeout_ms)
+{
+    if (max_backoff_us == 0) throw std::runtime_error("The longest backoff has to be at least 1 us!");
+    if (irq_timeout_ms == 0) throw std::runtime_error("The interrupt timeout has to be at least 1 ms!");
+    if (policy == WaitPolicy::IRQ)
+        {
+            // interrupt level 1, raised as soon as there is one event
+            // (aggregate), and released when the data is read (RORA).
+            // Not tested with a digitizer yet
+            current_error_ = CAEN_DGTZ_SetInterruptConfig(handle_, CAEN_DGTZ_ENABLE, 1, 0xAAAA, 1, CAEN_DGTZ_IRQ_MODE_RORA);
+            if (current_error_ != 0) throw std::runtime_error("Can not enable interrupts, err code " + std::to_string(current_error_));
+        }
+    else if (wait_policy_ == WaitPolicy::IRQ)
+        {
+            current_error_ = CAEN_DGTZ_SetInterruptConfig(handle_, CAEN_DGTZ_DISABLE, 1, 0xAAAA, 1, CAEN_DGTZ_IRQ_MODE_RORA);
+            if (current_error_ != 0) throw std::runtime_error("Can not disable interrupts, err code " + std::to_string(current_error_));
+        }
+    wait_policy_    = policy;
+    max_backoff_us_ = max_backoff_us;
+    irq_timeout_ms_ = irq_timeout_ms;
+}
+
+/*******************************************************************/
+
+WaitStats_t CaenN6725DPPPHA::get_wait_stats() const
+{
+    std::lock_guard<std::mutex> lock(wait_stats_mutex_);
+    WaitStats_t stats = wait_stats_;
+    uint64_t nready = stats.nwaits - stats.ntimeouts;
+    stats.mean_wait_us = (nready > 0) ? wait_us_total_/nready : 0;
+    return stats;
+}
+
+/*******************************************************************/
+
+void CaenN6725DPPPHA::reset_wait_stats()
+{
+    std::lock_guard<std::mutex> lock(wait_stats_mutex_);
+    wait_stats_    = WaitStats_t();
+    wait_us_total_ = 0;
+}
+
+/*******************************************************************/
+
+void CaenN6725DPPPHA::set_pipeline_depth(unsigned int depth)
+{
+    if (depth == 0) throw std::runtime_error("The pipeline needs at least one buffer!");
+    // the stages hold buffers of the pool, which would be freed
+    // under them. Checked by the pool as well, but a readout can
+    // have all of them free for a moment. Holding the guard, no
+    // readout can start before the buffers are reallocated
+    ReadoutGuard_ guard(readout_running_);
+    pipeline_depth_ = depth;
+    if (pool_.size() > 0) allocate_memory();
+}
+
+/*******************************************************************/
+
+std::vector<PipelineStats_t> CaenN6725DPPPHA::get_pipeline_stats() const
+{
+    return pipeline_stats_;
+}
 
 /*******************************************************************/
 
@@ -1916,9 +2194,13 @@ CaenN6725DPPPHA::~CaenN6725DPPPHA()
     {
         std::cout << "Closing digitizer..." << std::endl;
         CAEN_DGTZ_SWStopAcquisition(handle_);
-        CAEN_DGTZ_FreeReadoutBuffer(&buffer_);
-        //CAEN_DGTZ_FreeDPPEvents(handle_, &events_);
-        //CAEN_DGTZ_FreeDPPWaveforms(handle_, waveform_);
+        // readout, event and waveform buffers, while the handle is
+        // still open. If another thread still holds one of them, this
+        // throws and the destructor of the pool leaks them instead
+        try
+            {pool_.free();}
+        catch (std::exception const &)
+            {}
         CAEN_DGTZ_CloseDigitizer(handle_);
         //root_file_->Write();
         //delete root_file_;
@@ -0,0 +1,36 @@
+#include <vector>
+#include <algorithm>
+
+#include "baseline.h"
+
+float estimate_baseline(const int16_t* waveform, size_t nsamples, size_t nbaseline, BaselineMode mode) {
+  size_t n = std::min(nbaseline, nsamples);
+  if (n == 0) return 0;
+
+  if (mode == BaselineMode::Mean)
+    {
+      int64_t sum(0);
+      for (size_t k=0; k<n; k++)
+        {sum += waveform[k];}
+      return sum/(float)n;
+    }
+
+  // the robust estimators need a sorted copy of the
+  // pre-trigger samples, keep it around per thread
+  thread_local std::vector<int16_t> buffer;
+  buffer.assign(waveform, waveform + n);
+  if (mode == BaselineMode::Median)
+    {
+      std::nth_element(buffer.begin(), buffer.begin() + n/2, buffer.end());
+      return buffer[n/2];
+    }
+
+  std::sort(buffer.begin(), buffer.end());
+  size_t first = n/10;
+  size_t last  = n - n/10;
+  int64_t sum(0);
+  for (size_t k=first; k<last; k++)
+    {sum += buffer[k];}
+  return sum/(float)(last - first);
+};
+
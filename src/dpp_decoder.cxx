@@ -0,0 +1,41 @@
+#include "dpp_decoder.hh"
+
+/***************************************************************/
+
+int find_trigger_point(const uint8_t* dtrace2, uint32_t ns)
+{
+    for (uint32_t k=0; k<ns; k++)
+        {
+            if (dtrace2[k] > 0) return k;
+        }
+    return ns;
+}
+
+/***************************************************************/
+
+void decode_readout_buffer(int handle, ReadoutBuffer_t* raw, DecodedBlock_t* block,
+                           uint32_t channel_mask, bool decode_waveforms)
+{
+    for (int ch=0;ch<8;ch++)
+        {
+            block->energy[ch].clear();
+            block->trigger[ch].clear();
+            block->saturated[ch].clear();
+            block->nsamples[ch].clear();
+            block->waveforms[ch].clear();
+            if (!(channel_mask & (1<<ch))) continue;
+            for (uint32_t ev=0;ev<raw->num_events[ch];ev++)
+                {
+                    CAEN_DGTZ_DPP_PHA_Event_t &event = raw->events[ch][ev];
+                    block->energy[ch].push_back(event.Energy);
+                    block->saturated[ch].push_back((event.Extras & (1<<4)) ? 1 : 0);
+                    if (!decode_waveforms) continue;
+                    CAEN_DGTZ_DecodeDPPWaveforms(handle, &event, raw->waveform);
+                    uint32_t ns = raw->waveform->Ns;
+                    block->nsamples[ch].push_back(ns);
+                    block->trigger[ch].push_back(find_trigger_point(raw->waveform->DTrace2, ns));
+                    block->waveforms[ch].insert(block->waveforms[ch].end(),
+                                                raw->waveform->Trace1, raw->waveform->Trace1 + ns);
+                }
+        }
+}
@@ -0,0 +1,126 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <limits>
+
+#include "enc_scan.h"
+#include "parallel_for.h"
+#include "trapezoidal_kernels.h"
+
+/*********************************************************************/
+
+// the moments of the trapezoid output of a block of waveforms
+struct Moments_
+{
+    uint64_t n = 0;
+    int64_t sum = 0;
+    double sumsq = 0;
+};
+
+// outputs of the trapezoid which are closer than nramp/STRIDE_DIVISOR
+// samples are almost the same, only every stride-th is used
+static const size_t STRIDE_DIVISOR = 16;
+
+/*********************************************************************/
+
+ENCScanner::ENCScanner(std::vector<int> const &ptimes, int flat, size_t nbaseline, float sample_period) :
+                                                     ptimes(ptimes),
+                                                     flat(flat),
+                                                     nbaseline(nbaseline),
+                                                     sample_period(sample_period) {
+  if (sample_period <= 0)
+    throw std::runtime_error("The sample period has to be positive!");
+  if (flat < 0)
+    throw std::runtime_error("The flat top can not be negative!");
+  for (auto ptime : ptimes)
+    {
+      if (ptime < sample_period)
+        throw std::runtime_error("The peaking times have to be at least one sample!");
+    }
+};
+
+/*********************************************************************/
+
+void ENCScanner::scan(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                      float* noise, int nthreads) const {
+  size_t nsettings = ptimes.size();
+  size_t nsegment  = (nbaseline > 0) ? std::min(nbaseline, nsamples) : nsamples;
+  size_t nflat     = std::lround(flat/sample_period);
+
+  // every chunk of waveforms has its own sums, which are
+  // added up afterwards
+  const size_t chunk = 16;
+  std::vector<std::vector<Moments_>> chunk_moments((nwaveforms + chunk - 1)/chunk,
+                                                   std::vector<Moments_>(nsettings));
+  parallel_for(nwaveforms, nthreads, [&](size_t begin, size_t end) {
+    std::vector<uint32_t> cumsum(nsegment + 1);
+    std::vector<Moments_> &moments = chunk_moments[begin/chunk];
+    for (size_t k=begin; k<end; k++)
+      {
+        cumulative_sum(data + k*nsamples, nsegment, cumsum.data());
+        const uint32_t* c = cumsum.data();
+        for (size_t s=0; s<nsettings; s++)
+          {
+            size_t nramp      = std::lround(ptimes[s]/sample_period);
+            size_t nrampnflat = nramp + nflat;
+            size_t ntot       = 2*nramp + nflat;
+            if (ntot > nsegment) continue;
+            // S(i) as in cumulative_sum, the wrap around of
+            // the unsigned sums cancels
+            size_t stride = std::max<size_t>(1, nramp/STRIDE_DIVISOR);
+            int64_t sum(0);
+            double sumsq(0);
+            uint64_t n(0);
+            for (size_t i=ntot-1; i<nsegment; i+=stride)
+              {
+                int32_t amp_sum = (int32_t)((c[i+1] - c[i+1-nramp]) - (c[i+1-nrampnflat] - c[i+1-ntot]));
+                sum   += amp_sum;
+                sumsq += (double)amp_sum*amp_sum;
+                n++;
+              }
+            moments[s].n     += n;
+            moments[s].sum   += sum;
+            moments[s].sumsq += sumsq;
+          }
+      }
+  }, chunk);
+
+  for (size_t s=0; s<nsettings; s++)
+    {
+      Moments_ total;
+      for (auto const &moments : chunk_moments)
+        {
+          total.n     += moments[s].n;
+          total.sum   += moments[s].sum;
+          total.sumsq += moments[s].sumsq;
+        }
+      if (total.n == 0)
+        {
+          noise[s] = std::numeric_limits<float>::quiet_NaN();
+          continue;
+        }
+      double nramp    = std::lround(ptimes[s]/sample_period);
+      double mean     = (double)total.sum/total.n;
+      double variance = std::max(total.sumsq/total.n - mean*mean, 0.);
+      noise[s] = std::sqrt(variance)/nramp;
+    }
+};
+
+/*********************************************************************/
+
+int ENCScanner::best_ptime(const float* noise) const {
+  int best(-1);
+  float best_noise = std::numeric_limits<float>::infinity();
+  for (size_t s=0; s<ptimes.size(); s++)
+    {
+      if (noise[s] < best_noise)
+        {
+          best_noise = noise[s];
+          best       = ptimes[s];
+        }
+    }
+  if (best < 0)
+    throw std::runtime_error("None of the peaking times fits into the baseline, use shorter peaking times or a longer baseline!");
+  return best;
+};
+
@@ -0,0 +1,279 @@
+#include <stdexcept>
+#include <complex>
+#include <cmath>
+#include <algorithm>
+#include <string>
+
+#include "gaussian_shaper.h"
+#include "parallel_for.h"
+
+typedef std::complex<double> complex_t;
+
+/*********************************************************************/
+
+// Ohkawa's poles for a gaussian with unit width and the factor
+// relating the width to the peaking time, see shapers.py
+static void ohkawa_poles_(int order, std::vector<complex_t> &poles, double &tf) {
+  poles.clear();
+  switch (order)
+    {
+      case 1:
+        tf = 2*1.0844;
+        poles = {complex_t(-1, 0)};
+        break;
+      case 2:
+        {
+          tf = 9.734458e-01;
+          double c = std::sqrt(std::sqrt(2.) + 2)*0.5;
+          poles = {c*complex_t(-1, std::sqrt(2.) - 1), c*complex_t(-1, 1 - std::sqrt(2.))};
+          break;
+        }
+      case 3:
+        tf = 6.740357e-01;
+        poles = {complex_t(-1.2633573, 0),
+                 complex_t(-1.1490948, 0.7864188), complex_t(-1.1490948, -0.7864188)};
+        break;
+      case 4:
+        tf = 5.106046e-01;
+        poles = {complex_t(-1.3553576, 0.3277948), complex_t(-1.3553576, -0.3277948),
+                 complex_t(-1.1810803, 1.0603749), complex_t(-1.1810803, -1.0603749)};
+        break;
+      case 5:
+        tf = 4.267639e-01;
+        poles = {complex_t(-1.4766878, 0),
+                 complex_t(-1.4166647, 0.5978596), complex_t(-1.4166647, -0.5978596),
+                 complex_t(-1.2036832, 1.2994843), complex_t(-1.2036832, -1.2994843)};
+        break;
+      case 6:
+        tf = 3.737515e-01;
+        poles = {complex_t(-1.5601279, 0.2686793), complex_t(-1.5601279, -0.2686793),
+                 complex_t(-1.4613750, 0.8329565), complex_t(-1.4613750, -0.8329565),
+                 complex_t(-1.2207388, 1.5145343), complex_t(-1.2207388, -1.5145343)};
+        break;
+      case 7:
+        tf = 3.371212e-01;
+        poles = {complex_t(-1.6610245, 0),
+                 complex_t(-1.6229725, 0.5007975), complex_t(-1.6229725, -0.5007975),
+                 complex_t(-1.4949993, 1.0454546), complex_t(-1.4949993, -1.0454546),
+                 complex_t(-1.2344141, 1.7113028), complex_t(-1.2344141, -1.7113028)};
+        break;
+      default:
+        throw std::runtime_error("Only gaussian shaper orders between 1 and 7 are supported!");
+    }
+};
+
+/*********************************************************************/
+
+// run the cascade in double precision, used for the normalization
+static void sosfilt_(std::vector<std::vector<double>> const &sos, std::vector<double> &x) {
+  for (auto const &s : sos)
+    {
+      double z1(0), z2(0);
+      for (auto &v : x)
+        {
+          double y = s[0]*v + z1;
+          z1 = s[1]*v - s[4]*y + z2;
+          z2 = s[2]*v - s[5]*y;
+          v  = y;
+        }
+    }
+};
+
+/*********************************************************************/
+
+GaussianShaper::GaussianShaper(double peaktime, int order, double dt, double decay_time,
+                               int nbaseline, BaselineMode baseline_mode) :
+                                                     peaktime(peaktime),
+                                                     order(order),
+                                                     dt(dt),
+                                                     decay_time(decay_time),
+                                                     nbaseline(nbaseline),
+                                                     baseline_mode(baseline_mode) {
+  if ((peaktime <= 0) || (dt <= 0))
+    throw std::runtime_error("Peaking time and sample period have to be positive!");
+  if (decay_time <= 0)
+    throw std::runtime_error("The decay time has to be positive!");
+  if (nbaseline < 0)
+    throw std::runtime_error("The number of baseline samples can not be negative!");
+
+  // analog poles and the zero cancelling the pole of the tail pulse
+  std::vector<complex_t> poles;
+  double tf;
+  ohkawa_poles_(order, poles, tf);
+  double sigma = tf*peaktime;
+  for (auto &p : poles)
+    {p /= sigma;}
+  double pz = 1./decay_time;
+
+  // bilinear transform, the zeros at infinity go to z = -1
+  double fs2 = 2./dt;
+  for (auto &p : poles)
+    {p = (fs2 + p)/(fs2 - p);}
+  double zero = (fs2 - pz)/(fs2 + pz);
+
+  // one section per complex conjugate pair, a real pole gets
+  // a first order section. The pole-zero cancellation zero
+  // goes into the first section, all other zeros are at -1
+  std::vector<std::vector<double>> sos;
+  size_t ip = 0;
+  if (poles.size() % 2)
+    {
+      sos.push_back({1, -zero, 0, 1, -poles[0].real(), 0});
+      ip = 1;
+    }
+  for (; ip<poles.size(); ip+=2)
+    {
+      complex_t p = poles[ip];
+      std::vector<double> s = {1, 2, 1, 1, -2*p.real(), std::norm(p)};
+      if (sos.empty())
+        {
+          // zeros at the cancellation zero and -1
+          s[1] = 1 - zero;
+          s[2] = -zero;
+        }
+      sos.push_back(s);
+    }
+
+  // normalize to unity peak height for a tail pulse, the
+  // same way as shapers.py does it
+  size_t npre  = (size_t)(peaktime/dt);
+  size_t ntail = (size_t)(2*peaktime/dt);
+  std::vector<double> tail(npre + ntail + 1, 0);
+  for (size_t n=npre+1; n<tail.size(); n++)
+    {tail[n] = std::exp(-(double)(n - npre)*dt*pz);}
+  sosfilt_(sos, tail);
+  double ymax = *std::max_element(tail.begin(), tail.end());
+  if (ymax <= 0)
+    throw std::runtime_error("Can not normalize the shaper, peaking time too short?");
+  // distribute the gain evenly over the sections, which keeps
+  // the state variables in a sensible range
+  double gain = std::pow(1./ymax, 1./sos.size());
+  for (auto &s : sos)
+    {
+      for (size_t k=0; k<3; k++)
+        {s[k] *= gain;}
+    }
+
+  // the state of the cascade is kept on the stack, see shape_lanes_
+  if (sos.size() > MAXNSECTIONS)
+    throw std::runtime_error("The shaper has more than " + std::to_string(MAXNSECTIONS) + " sections!");
+  for (auto const &s : sos)
+    {sections_.push_back({s[0], s[1], s[2], s[4], s[5]});}
+};
+
+/*********************************************************************/
+
+const size_t GaussianShaper::MAXNSECTIONS;
+
+/*********************************************************************/
+
+float GaussianShaper::shape_it(const std::vector<int16_t> &waveform) const {
+  float energy(0);
+  shape_lanes_<1>(waveform.data(), waveform.size(), &energy);
+  return energy;
+};
+
+/*********************************************************************/
+
+void GaussianShaper::shape_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                                 float* energies, int nthreads) const {
+  const size_t nlanes = 8;
+  size_t nblocks = (nwaveforms + nlanes - 1)/nlanes;
+  parallel_for(nblocks, nthreads, [&](size_t begin, size_t end) {
+    for (size_t b=begin; b<end; b++)
+      {
+        size_t k = b*nlanes;
+        if (k + nlanes <= nwaveforms)
+          {shape_lanes_<nlanes>(data + k*nsamples, nsamples, energies + k);}
+        else
+          {
+            for (; k<nwaveforms; k++)
+              {shape_lanes_<1>(data + k*nsamples, nsamples, energies + k);}
+          }
+      }
+  }, 4);
+};
+
+/*********************************************************************/
+
+void GaussianShaper::shape_traces(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                                  float* traces, size_t decimation, int nthreads) const {
+  if (decimation == 0)
+    throw std::runtime_error("Decimation has to be at least 1!");
+  const size_t nlanes = 8;
+  size_t ntrace  = (nsamples + decimation - 1)/decimation;
+  size_t nblocks = (nwaveforms + nlanes - 1)/nlanes;
+  parallel_for(nblocks, nthreads, [&](size_t begin, size_t end) {
+    float energies[nlanes];
+    for (size_t b=begin; b<end; b++)
+      {
+        size_t k = b*nlanes;
+        if (k + nlanes <= nwaveforms)
+          {shape_lanes_<nlanes>(data + k*nsamples, nsamples, energies, traces + k*ntrace, ntrace, decimation);}
+        else
+          {
+            for (; k<nwaveforms; k++)
+              {shape_lanes_<1>(data + k*nsamples, nsamples, energies, traces + k*ntrace, ntrace, decimation);}
+          }
+      }
+  }, 4);
+};
+
+/*********************************************************************/
+
+std::vector<std::vector<double>> GaussianShaper::get_sos() const {
+  std::vector<std::vector<double>> sos;
+  for (auto const &s : sections_)
+    {sos.push_back({s.b0, s.b1, s.b2, 1, s.a1, s.a2});}
+  return sos;
+};
+
+/*********************************************************************/
+
+template<size_t NLANES>
+void GaussianShaper::shape_lanes_(const int16_t* data, size_t nsamples, float* energies,
+                                  float* traces, size_t ntrace, size_t decimation) const {
+  // transposed direct form II, all sections are run sample by
+  // sample, so that every waveform is only touched once (the
+  // baseline samples are still in the cache when the filter
+  // gets to them). The
+  // recursions of the different lanes are independent and can
+  // be in flight at the same time
+  const size_t nsections = sections_.size();
+  double z1[MAXNSECTIONS][NLANES] = {};
+  double z2[MAXNSECTIONS][NLANES] = {};
+  double ymax[NLANES];
+  double baseline[NLANES];
+  for (size_t j=0; j<NLANES; j++)
+    {
+      ymax[j]     = 0;
+      baseline[j] = estimate_baseline(data + j*nsamples, nsamples, nbaseline, baseline_mode);
+    }
+  for (size_t n=0; n<nsamples; n++)
+    {
+      double y[NLANES];
+      for (size_t j=0; j<NLANES; j++)
+        {y[j] = data[j*nsamples + n] - baseline[j];}
+      for (size_t k=0; k<nsections; k++)
+        {
+          const Section &s = sections_[k];
+          for (size_t j=0; j<NLANES; j++)
+            {
+              double x = y[j];
+              y[j]     = s.b0*x + z1[k][j];
+              z1[k][j] = s.b1*x - s.a1*y[j] + z2[k][j];
+              z2[k][j] = s.b2*x - s.a2*y[j];
+            }
+        }
+      for (size_t j=0; j<NLANES; j++)
+        {ymax[j] = std::max(ymax[j], y[j]);}
+      if (traces && (n % decimation == 0))
+        {
+          for (size_t j=0; j<NLANES; j++)
+            {traces[j*ntrace + n/decimation] = y[j];}
+        }
+    }
+  for (size_t j=0; j<NLANES; j++)
+    {energies[j] = ymax[j];}
+};
+
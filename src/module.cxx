@@ -1,15 +1,110 @@
 #include "CaenN6725.hh"
 #include "trapezoidal_shaper.h" 
+#include "gaussian_shaper.h"
+#include "pileup_rejector.h"
+#include "streaming_trapezoid.h"
+#include "trigger_finder.h"
+#include "pulse_features.h"
+#include "enc_scan.h"
+#include "tile_scheduler.h"
+#include "noise_psd.h"
 
 #include <pybind11/pybind11.h>
 #include <pybind11/stl.h>
 #include <pybind11/complex.h>
 #include <pybind11/functional.h>
 #include <pybind11/chrono.h>
+#include <pybind11/numpy.h>
+
+#include <cstring>
 
 
 namespace py = pybind11;
 
+// shape a 2D array (nwaveforms x recordlength) of int16 waveforms and return
+// one result per waveform. The buffer is read in place (no copy if it is already
+// a C-contiguous int16 array) and the GIL is released while the native threads
+// work. Batch is the method doing this, the shape_batch of the shaper by default
+template<typename Shaper, typename Out,
+         void (Shaper::*Batch)(const int16_t*, size_t, size_t, Out*, int) const = &Shaper::shape_batch>
+py::array_t<Out> shape_batch_(const Shaper &shaper,
+                              py::array_t<int16_t, py::array::c_style | py::array::forcecast> waveforms,
+                              int nthreads)
+{
+    if (waveforms.ndim() != 2)
+        throw std::runtime_error("Waveforms have to be given as 2D array (nwaveforms x recordlength)!");
+    size_t nwaveforms = waveforms.shape(0);
+    size_t nsamples   = waveforms.shape(1);
+    py::array_t<Out> result(nwaveforms);
+    const int16_t* data = waveforms.data();
+    Out* out            = result.mutable_data();
+    {
+        py::gil_scoped_release release;
+        (shaper.*Batch)(data, nwaveforms, nsamples, out, nthreads);
+    }
+    return result;
+}
+
+// time between two samples of the trapezoid in ns. The N6725 samples every
+// 4ns, the firmware decimation (0 : off, 1 : 2, 2 : 4, 3 : 8 samples)
+// stretches this by 2^decimation
+static float sample_period_(int decimation)
+{
+    if ((decimation < 0) || (decimation > 3))
+        throw std::runtime_error("Decimation has to be between 0 and 3, not " + std::to_string(decimation) + "!");
+    return 4.f*(1 << decimation);
+}
+
+// the DPP-PHA parameters hold the settings of all channels
+static void check_channel_(int channel)
+{
+    if ((channel < 0) || (channel >= MAX_DPP_PHA_CHANNEL_SIZE))
+        throw std::runtime_error("No channel " + std::to_string(channel) + " in the DPP-PHA parameters!");
+}
+
+// shape a 2D array (nwaveforms x recordlength) of int16 waveforms and return
+// the full traces as (nwaveforms x trace length) float32 array. If out is given
+// it has to be a C-contiguous float32 array of this shape, which is then filled
+// in place, so the same buffer can be used for every batch
+template<typename Shaper>
+py::array_t<float> shape_traces_(const Shaper &shaper,
+                                 py::array_t<int16_t, py::array::c_style | py::array::forcecast> waveforms,
+                                 py::object out, size_t decimation, int nthreads)
+{
+    if (waveforms.ndim() != 2)
+        throw std::runtime_error("Waveforms have to be given as 2D array (nwaveforms x recordlength)!");
+    size_t nwaveforms = waveforms.shape(0);
+    size_t nsamples   = waveforms.shape(1);
+    size_t ntrace     = TrapezoidalFilter::get_trace_length(nsamples, decimation);
+    py::array_t<float, py::array::c_style> traces;
+    if (out.is_none())
+        {traces = py::array_t<float, py::array::c_style>({nwaveforms, ntrace});}
+    else
+        {
+            // no conversion here, this would silently write into a copy
+            if (!py::isinstance<py::array_t<float, py::array::c_style>>(out))
+                throw std::runtime_error("out has to be a C-contiguous float32 array!");
+            traces = out.cast<py::array_t<float, py::array::c_style>>();
+            if ((traces.ndim() != 2) || ((size_t)traces.shape(0) != nwaveforms) || ((size_t)traces.shape(1) != ntrace))
+                throw std::runtime_error("out has the wrong shape, expected (nwaveforms x " + std::to_string(ntrace) + ")!");
+        }
+    const int16_t* data = waveforms.data();
+    float* buffer       = traces.mutable_data();
+    {
+        py::gil_scoped_release release;
+        shaper.shape_traces(data, nwaveforms, nsamples, buffer, decimation, nthreads);
+    }
+    return traces;
+}
+
+// a trace of the digitizer as numpy array, one copy of the whole
+// trace instead of a python int per sample
+template<typename T>
+py::array_t<T> trace_to_numpy_(const std::vector<T> &trace)
+{
+    return py::array_t<T>(trace.size(), trace.data());
+}
+
 //std::string to_string(char c_string[])
 //{
 //    return std::string(c_string);
@@ -386,6 +481,42 @@ PYBIND11_MODULE(_pyCaenN6725, m) {
         .def_readwrite("waveforms", &CAEN_DGTZ_DPP_PHA_Event_t::Waveforms)
         .def_readwrite("extras2", &CAEN_DGTZ_DPP_PHA_Event_t::Extras2);
 
+    // the event words for read_data_array, as numpy structured array
+    PYBIND11_NUMPY_DTYPE(DPPEventRecord_t, time_tag, energy, extras, extras2);
+
+    py::enum_<WaitPolicy>(m, "WaitPolicy")
+        .value("Poll",    WaitPolicy::Poll)
+        .value("Backoff", WaitPolicy::Backoff)
+        .value("IRQ",     WaitPolicy::IRQ)
+        .export_values();
+
+    py::class_<WaitStats_t>(m, "WaitStats")
+        .def(py::init())
+        .def_readonly("nwaits",       &WaitStats_t::nwaits)
+        .def_readonly("npolls",       &WaitStats_t::npolls)
+        .def_readonly("nirqs",        &WaitStats_t::nirqs)
+        .def_readonly("ntimeouts",    &WaitStats_t::ntimeouts)
+        .def_readonly("mean_wait_us", &WaitStats_t::mean_wait_us)
+        .def_readonly("max_wait_us",  &WaitStats_t::max_wait_us)
+        .def("__repr__", [](const WaitStats_t &s) {
+            return "<WaitStats " + std::to_string(s.nwaits) + " waits, " + std::to_string(s.npolls) + " polls, "
+                   + std::to_string(s.nirqs) + " irqs, mean wait " + std::to_string(s.mean_wait_us) + " us>";
+        });
+
+    // the queues of the continuous_readout pipeline
+    py::class_<PipelineStats_t>(m, "PipelineStats")
+        .def(py::init())
+        .def_readonly("queue",      &PipelineStats_t::queue)
+        .def_readonly("nblocks",    &PipelineStats_t::nblocks)
+        .def_readonly("nfull",      &PipelineStats_t::nfull)
+        .def_readonly("nempty",     &PipelineStats_t::nempty)
+        .def_readonly("max_depth",  &PipelineStats_t::max_depth)
+        .def_readonly("mean_depth", &PipelineStats_t::mean_depth)
+        .def("__repr__", [](const PipelineStats_t &s) {
+            return "<PipelineStats " + s.queue + ": " + std::to_string(s.nblocks) + " blocks, max depth "
+                   + std::to_string(s.max_depth) + ", producer waited " + std::to_string(s.nfull) + "x>";
+        });
+
     py::enum_<CAEN_DGTZ_ErrorCode>(m, "CaenErrorCode")
         .value("CAEN_DGTZ_Success"                    , CAEN_DGTZ_ErrorCode::CAEN_DGTZ_Success) 
         .value("CAEN_DGTZ_CommError"                  , CAEN_DGTZ_ErrorCode::CAEN_DGTZ_CommError) 
@@ -575,21 +706,50 @@ PYBIND11_MODULE(_pyCaenN6725, m) {
         .def("get_temperatures",              &CaenN6725DPPPHA::get_temperatures)
         .def("configure_channel",             &CaenN6725DPPPHA::configure_channel)
         .def("calibrate",                     &CaenN6725DPPPHA::calibrate)
-        .def("read_data",                     &CaenN6725DPPPHA::read_data)
-        .def("get_last_waveform",             &CaenN6725DPPPHA::get_last_waveform)
+        .def("read_data",                     &CaenN6725DPPPHA::read_data,
+                                              py::call_guard<py::gil_scoped_release>())
+        // the events of the next block as one numpy structured array per
+        // channel (fields time_tag, energy, extras, extras2), without a
+        // python object per event
+        .def("read_data_array", [](CaenN6725DPPPHA &d, bool fill_histogram) {
+            {
+                py::gil_scoped_release release;
+                d.read_data_records(fill_histogram);
+            }
+            py::list channels;
+            for (int ch=0; ch<d.get_nchannels(); ch++)
+                {
+                    const std::vector<DPPEventRecord_t> &records = d.get_event_records(ch);
+                    py::array_t<DPPEventRecord_t> events(records.size());
+                    if (!records.empty())
+                        std::memcpy(events.mutable_data(), records.data(), records.size()*sizeof(DPPEventRecord_t));
+                    channels.append(events);
+                }
+            return channels;
+        }, py::arg("fill_histogram") = false)
+        .def("get_last_waveform",             [](const CaenN6725DPPPHA &d, int channel) {
+                                                  return trace_to_numpy_(d.get_last_waveform(channel));})
         .def("clear_energy_histogram",        &CaenN6725DPPPHA::clear_energy_histogram)
         .def("get_energy_histogram",          &CaenN6725DPPPHA::get_energy_histogram)
         .def("get_current_sampling_rate",     &CaenN6725DPPPHA::get_current_sampling_rate)
-        .def("get_analog_trace1",             &CaenN6725DPPPHA::get_analog_trace1)
-        .def("get_analog_trace2",             &CaenN6725DPPPHA::get_analog_trace2)
-        .def("get_digital_trace1",            &CaenN6725DPPPHA::get_digital_trace1)
-        .def("get_digital_trace2",            &CaenN6725DPPPHA::get_digital_trace2)
+        .def("get_analog_trace1",             [](const CaenN6725DPPPHA &d) {return trace_to_numpy_(d.get_analog_trace1());})
+        .def("get_analog_trace2",             [](const CaenN6725DPPPHA &d) {return trace_to_numpy_(d.get_analog_trace2());})
+        .def("get_digital_trace1",            [](const CaenN6725DPPPHA &d) {return trace_to_numpy_(d.get_digital_trace1());})
+        .def("get_digital_trace2",            [](const CaenN6725DPPPHA &d) {return trace_to_numpy_(d.get_digital_trace2());})
         .def("get_trigger_point",             &CaenN6725DPPPHA::get_trigger_point)
         .def("set_vprobe1",                   &CaenN6725DPPPHA::set_virtualprobe1)
         .def("set_vprobe2",                   &CaenN6725DPPPHA::set_virtualprobe2)
         .def("set_dprobe1",                   &CaenN6725DPPPHA::set_digitalprobe1)
         .def("set_dprobe2",                   &CaenN6725DPPPHA::set_digitalprobe2)
-        .def("continuous_readout",            &CaenN6725DPPPHA::continuous_readout)
+        .def("continuous_readout",            &CaenN6725DPPPHA::continuous_readout,
+                                              py::call_guard<py::gil_scoped_release>())
+        .def("set_pipeline_depth",            &CaenN6725DPPPHA::set_pipeline_depth)
+        .def("get_pipeline_stats",            &CaenN6725DPPPHA::get_pipeline_stats)
+        .def("set_wait_policy",               &CaenN6725DPPPHA::set_wait_policy,
+                                              py::arg("policy"), py::arg("max_backoff_us") = 100,
+                                              py::arg("irq_timeout_ms") = 100)
+        .def("get_wait_stats",                &CaenN6725DPPPHA::get_wait_stats)
+        .def("reset_wait_stats",              &CaenN6725DPPPHA::reset_wait_stats)
         .def("is_active",                     &CaenN6725DPPPHA::is_active)
         .def("set_rootfilename",              &CaenN6725DPPPHA::set_rootfilename)
         .def("set_channel_dc_offset",         &CaenN6725DPPPHA::set_channel_dc_offset)
@@ -650,25 +810,506 @@ PYBIND11_MODULE(_pyCaenN6725, m) {
         .def("set_input_dynamic_range",       &CaenN6725WF::set_input_dynamic_range)
         .def("get_input_dynamic_range",       &CaenN6725WF::get_input_dynamic_range);
 
+    py::enum_<BaselineMode>(m, "BaselineMode")
+        .value("Mean",          BaselineMode::Mean)
+        .value("Median",        BaselineMode::Median)
+        .value("TruncatedMean", BaselineMode::TruncatedMean)
+        .export_values();
+
     // the trapezoidal filter
     py::class_<TrapezoidalFilter>(m, "TrapezoidalFilter")
-        .def(py::init<int, int, int>())//,
-            // FIXME: the proper constructor with keyword support 
-            // py::arg("ptime"), py::kwarg("flat")=1000., py::kwarg("recordlength")=50000
-            //)
+        .def(py::init<int, int, int, float, int>(),
+             py::arg("ptime"), py::arg("flat") = 1000, py::arg("recordlength") = 50000,
+             py::arg("sample_period") = 4, py::arg("decimation") = 1)
         .def("shape_it", &TrapezoidalFilter::shape_it)
+        // shape a 2D array (nwaveforms x recordlength) of int16 waveforms
+        .def("shape_batch", &shape_batch_<TrapezoidalFilter, float>,
+             py::arg("waveforms"), py::arg("nthreads") = 0)
+        // the full filter output, optionally into a preallocated array
+        .def("shape_traces", &shape_traces_<TrapezoidalFilter>,
+             py::arg("waveforms"), py::arg("out") = py::none(),
+             py::arg("decimation") = 1, py::arg("nthreads") = 0)
+        .def_static("get_trace_length", &TrapezoidalFilter::get_trace_length)
+        // which SIMD kernel got picked for this cpu
+        .def_static("get_kernel_name", &TrapezoidalFilter::get_kernel_name)
+        .def_readonly("sample_period", &TrapezoidalFilter::sample_period)
+        .def_readonly("decimation",    &TrapezoidalFilter::decimation)
         // we need __getstate__ and __setstate__ so that we are capable of pickling our class
         // - this is important for the use with python multiprocessing module, 
         // since this requires pickleable objects.
         .def("__getstate__", [](const TrapezoidalFilter &t) {
-            return py::make_tuple(t.ptime, t.flat, t.recordlength);
+            return py::make_tuple(t.ptime, t.flat, t.recordlength, t.sample_period, t.decimation);
         })
         .def("__setstate__", [](TrapezoidalFilter &trap, py::tuple t) {
+            if (t.size() != 5)
+                throw std::runtime_error("Invalid state!");
+            new (&trap) TrapezoidalFilter(t[0].cast<int>(),t[1].cast<int>(),t[2].cast<int>(),
+                                          t[3].cast<float>(),t[4].cast<int>());
+        });
+
+    // the pole-zero corrected trapezoid of the DPP-PHA firmware
+    py::class_<PoleZeroTrapezoidalFilter>(m, "PoleZeroTrapezoidalFilter")
+        .def(py::init<int, int, int, int, int, int, BaselineMode, float>(),
+             py::arg("rise"), py::arg("flat"), py::arg("decay"),
+             py::arg("flat_top_delay") = 800, py::arg("peak_mean") = 0,
+             py::arg("nbaseline") = 1000, py::arg("baseline_mode") = BaselineMode::Mean,
+             py::arg("sample_period") = 4)
+        // take the settings from the channel parameters which are
+        // programmed into the digitizer
+        .def(py::init([](const ChannelParams_t &params) {
+            return new PoleZeroTrapezoidalFilter(params.trapezoidal_rise_time,
+                                                 params.trapezoidal_flat_top,
+                                                 params.input_decay_time,
+                                                 params.flat_top_delay,
+                                                 params.peak_mean,
+                                                 1000, BaselineMode::Mean,
+                                                 sample_period_(params.decimation));
+        }), py::arg("channel_params"))
+        // or from one channel of the DPP-PHA parameters, as
+        // returned by CaenN6725.extract_dpp_pha_parameters
+        .def(py::init([](const CAEN_DGTZ_DPP_PHA_Params_t &pars, int channel) {
+            check_channel_(channel);
+            return new PoleZeroTrapezoidalFilter(pars.k[channel], pars.m[channel], pars.M[channel],
+                                                 pars.ftd[channel], pars.nspk[channel],
+                                                 1000, BaselineMode::Mean,
+                                                 sample_period_(pars.decimation[channel]));
+        }), py::arg("dpp_params"), py::arg("channel"))
+        .def("shape_it", &PoleZeroTrapezoidalFilter::shape_it)
+        .def("shape_batch", &shape_batch_<PoleZeroTrapezoidalFilter, float>,
+             py::arg("waveforms"), py::arg("nthreads") = 0)
+        .def_readwrite("rise",           &PoleZeroTrapezoidalFilter::rise)
+        .def_readwrite("flat",           &PoleZeroTrapezoidalFilter::flat)
+        .def_readwrite("decay",          &PoleZeroTrapezoidalFilter::decay)
+        .def_readwrite("flat_top_delay", &PoleZeroTrapezoidalFilter::flat_top_delay)
+        .def_readwrite("peak_mean",      &PoleZeroTrapezoidalFilter::peak_mean)
+        .def_readwrite("nbaseline",      &PoleZeroTrapezoidalFilter::nbaseline)
+        .def_readwrite("baseline_mode",  &PoleZeroTrapezoidalFilter::baseline_mode)
+        .def_readwrite("sample_period",  &PoleZeroTrapezoidalFilter::sample_period)
+        .def("__getstate__", [](const PoleZeroTrapezoidalFilter &t) {
+            return py::make_tuple(t.rise, t.flat, t.decay, t.flat_top_delay, t.peak_mean,
+                                  t.nbaseline, t.baseline_mode, t.sample_period);
+        })
+        .def("__setstate__", [](PoleZeroTrapezoidalFilter &trap, py::tuple t) {
+            if (t.size() != 8)
+                throw std::runtime_error("Invalid state!");
+            new (&trap) PoleZeroTrapezoidalFilter(t[0].cast<int>(),t[1].cast<int>(),t[2].cast<int>(),
+                                                  t[3].cast<int>(),t[4].cast<int>(),
+                                                  t[5].cast<int>(),t[6].cast<BaselineMode>(),
+                                                  t[7].cast<float>());
+        });
+
+    // energy from the flat top after the trigger
+    py::class_<FlatTopTrapezoidalFilter>(m, "FlatTopTrapezoidalFilter")
+        .def(py::init<int, int, int, int, float, int, float>(),
+             py::arg("ptime"), py::arg("flat") = 1000,
+             py::arg("flat_top_delay") = 800, py::arg("peak_mean") = 0,
+             py::arg("threshold") = 50, py::arg("fast_ptime") = 100,
+             py::arg("sample_period") = 4)
+        .def("shape_it", &FlatTopTrapezoidalFilter::shape_it)
+        .def("shape_batch", &shape_batch_<FlatTopTrapezoidalFilter, float>,
+             py::arg("waveforms"), py::arg("nthreads") = 0)
+        .def("find_trigger", [](const FlatTopTrapezoidalFilter &t, std::vector<int16_t> const &waveform) {
+            return t.find_trigger(waveform.data(), waveform.size());
+        })
+        .def_readwrite("ptime",          &FlatTopTrapezoidalFilter::ptime)
+        .def_readwrite("flat",           &FlatTopTrapezoidalFilter::flat)
+        .def_readwrite("flat_top_delay", &FlatTopTrapezoidalFilter::flat_top_delay)
+        .def_readwrite("peak_mean",      &FlatTopTrapezoidalFilter::peak_mean)
+        .def_readwrite("threshold",      &FlatTopTrapezoidalFilter::threshold)
+        .def_readwrite("fast_ptime",     &FlatTopTrapezoidalFilter::fast_ptime)
+        .def_readwrite("sample_period",  &FlatTopTrapezoidalFilter::sample_period)
+        .def("__getstate__", [](const FlatTopTrapezoidalFilter &t) {
+            return py::make_tuple(t.ptime, t.flat, t.flat_top_delay, t.peak_mean, t.threshold, t.fast_ptime,
+                                  t.sample_period);
+        })
+        .def("__setstate__", [](FlatTopTrapezoidalFilter &trap, py::tuple t) {
+            if (t.size() != 7)
+                throw std::runtime_error("Invalid state!");
+            new (&trap) FlatTopTrapezoidalFilter(t[0].cast<int>(),t[1].cast<int>(),t[2].cast<int>(),
+                                                 t[3].cast<int>(),t[4].cast<float>(),t[5].cast<int>(),
+                                                 t[6].cast<float>());
+        });
+
+    // integer trapezoid, emulating the energy word of the firmware
+    py::class_<FixedPointTrapezoidalFilter>(m, "FixedPointTrapezoidalFilter")
+        .def(py::init<int, int, int, int, int, int, float, float>(),
+             py::arg("rise"), py::arg("flat"), py::arg("decay"),
+             py::arg("flat_top_delay") = 800, py::arg("peak_mean") = 0,
+             py::arg("nsamples_baseline") = 2, py::arg("energy_normalization") = 1.0,
+             py::arg("sample_period") = 4)
+        .def(py::init([](const ChannelParams_t &params) {
+            return new FixedPointTrapezoidalFilter(params.trapezoidal_rise_time,
+                                                   params.trapezoidal_flat_top,
+                                                   params.input_decay_time,
+                                                   params.flat_top_delay,
+                                                   params.peak_mean,
+                                                   params.nsamples_baseline,
+                                                   params.energy_normalization,
+                                                   sample_period_(params.decimation));
+        }), py::arg("channel_params"))
+        .def(py::init([](const CAEN_DGTZ_DPP_PHA_Params_t &pars, int channel) {
+            check_channel_(channel);
+            return new FixedPointTrapezoidalFilter(pars.k[channel], pars.m[channel], pars.M[channel],
+                                                   pars.ftd[channel], pars.nspk[channel],
+                                                   pars.nsbl[channel], pars.enf[channel],
+                                                   sample_period_(pars.decimation[channel]));
+        }), py::arg("dpp_params"), py::arg("channel"))
+        .def("shape_it", &FixedPointTrapezoidalFilter::shape_it)
+        .def("shape_batch", &shape_batch_<FixedPointTrapezoidalFilter, uint16_t>,
+             py::arg("waveforms"), py::arg("nthreads") = 0)
+        .def_readonly_static("MAXNBITS", &FixedPointTrapezoidalFilter::MAXNBITS)
+        .def_readwrite("rise",                 &FixedPointTrapezoidalFilter::rise)
+        .def_readwrite("flat",                 &FixedPointTrapezoidalFilter::flat)
+        .def_readwrite("decay",                &FixedPointTrapezoidalFilter::decay)
+        .def_readwrite("flat_top_delay",       &FixedPointTrapezoidalFilter::flat_top_delay)
+        .def_readwrite("peak_mean",            &FixedPointTrapezoidalFilter::peak_mean)
+        .def_readwrite("nsamples_baseline",    &FixedPointTrapezoidalFilter::nsamples_baseline)
+        .def_readwrite("energy_normalization", &FixedPointTrapezoidalFilter::energy_normalization)
+        .def_readwrite("sample_period",        &FixedPointTrapezoidalFilter::sample_period)
+        .def("__getstate__", [](const FixedPointTrapezoidalFilter &t) {
+            return py::make_tuple(t.rise, t.flat, t.decay, t.flat_top_delay, t.peak_mean,
+                                  t.nsamples_baseline, t.energy_normalization, t.sample_period);
+        })
+        .def("__setstate__", [](FixedPointTrapezoidalFilter &trap, py::tuple t) {
+            if (t.size() != 8)
+                throw std::runtime_error("Invalid state!");
+            new (&trap) FixedPointTrapezoidalFilter(t[0].cast<int>(),t[1].cast<int>(),t[2].cast<int>(),
+                                                    t[3].cast<int>(),t[4].cast<int>(),
+                                                    t[5].cast<int>(),t[6].cast<float>(),
+                                                    t[7].cast<float>());
+        });
+
+    // pulses found by the PileupRejector, as numpy structured array
+    PYBIND11_NUMPY_DTYPE(Pulse_t, waveform, trigger, energy, flags);
+
+    py::enum_<PulseFlag>(m, "PulseFlag", py::arithmetic())
+        .value("Pileup",    PulseFlag::Pileup)
+        .value("Truncated", PulseFlag::Truncated)
+        .export_values();
+
+    py::class_<PileupRejector>(m, "PileupRejector")
+        .def(py::init<int, int, int, int, float, float>(),
+             py::arg("ptime"), py::arg("flat") = 1000,
+             py::arg("fast_ptime") = 100, py::arg("fast_flat") = 100,
+             py::arg("threshold") = 50, py::arg("sample_period") = 4)
+        // returns the pulses of all waveforms (structured array with the fields
+        // waveform, trigger, energy, flags) and the number of pulses and of
+        // piled up pulses per waveform
+        .def("find_pulses", [](const PileupRejector &p,
+                               py::array_t<int16_t, py::array::c_style | py::array::forcecast> waveforms,
+                               bool reject, int nthreads) {
+            if (waveforms.ndim() != 2)
+                throw std::runtime_error("Waveforms have to be given as 2D array (nwaveforms x recordlength)!");
+            size_t nwaveforms = waveforms.shape(0);
+            size_t nsamples   = waveforms.shape(1);
+            py::array_t<uint32_t> npulses(nwaveforms);
+            py::array_t<uint32_t> npileup(nwaveforms);
+            const int16_t* data = waveforms.data();
+            uint32_t* npulses_data = npulses.mutable_data();
+            uint32_t* npileup_data = npileup.mutable_data();
+            std::vector<Pulse_t> found;
+            {
+                py::gil_scoped_release release;
+                p.find_pulses_batch(data, nwaveforms, nsamples, found, npulses_data, npileup_data, reject, nthreads);
+            }
+            py::array_t<Pulse_t> pulses(found.size());
+            if (!found.empty())
+                std::memcpy(pulses.mutable_data(), found.data(), found.size()*sizeof(Pulse_t));
+            return py::make_tuple(pulses, npulses, npileup);
+        }, py::arg("waveforms"), py::arg("reject") = false, py::arg("nthreads") = 0)
+        .def_readwrite("ptime",      &PileupRejector::ptime)
+        .def_readwrite("flat",       &PileupRejector::flat)
+        .def_readwrite("fast_ptime", &PileupRejector::fast_ptime)
+        .def_readwrite("fast_flat",  &PileupRejector::fast_flat)
+        .def_readwrite("threshold",  &PileupRejector::threshold)
+        .def_readwrite("sample_period", &PileupRejector::sample_period)
+        .def("__getstate__", [](const PileupRejector &p) {
+            return py::make_tuple(p.ptime, p.flat, p.fast_ptime, p.fast_flat, p.threshold, p.sample_period);
+        })
+        .def("__setstate__", [](PileupRejector &rejector, py::tuple t) {
+            if (t.size() != 6)
+                throw std::runtime_error("Invalid state!");
+            new (&rejector) PileupRejector(t[0].cast<int>(),t[1].cast<int>(),t[2].cast<int>(),
+                                           t[3].cast<int>(),t[4].cast<float>(),t[5].cast<float>());
+        });
+
+    // the semi-gaussian (Ohkawa) shaper, all times in ns
+    py::class_<GaussianShaper>(m, "GaussianShaper")
+        .def(py::init<double, int, double, double, int, BaselineMode>(),
+             py::arg("peaktime"), py::arg("order") = 4,
+             py::arg("dt") = 4, py::arg("decay_time") = 80000,
+             py::arg("nbaseline") = 1000, py::arg("baseline_mode") = BaselineMode::Mean)
+        .def("shape_it", &GaussianShaper::shape_it)
+        .def("shape_batch", &shape_batch_<GaussianShaper, float>,
+             py::arg("waveforms"), py::arg("nthreads") = 0)
+        .def("shape_traces", &shape_traces_<GaussianShaper>,
+             py::arg("waveforms"), py::arg("out") = py::none(),
+             py::arg("decimation") = 1, py::arg("nthreads") = 0)
+        .def("get_sos", &GaussianShaper::get_sos)
+        .def_readonly("peaktime",   &GaussianShaper::peaktime)
+        .def_readonly("order",      &GaussianShaper::order)
+        .def_readonly("dt",         &GaussianShaper::dt)
+        .def_readonly("decay_time", &GaussianShaper::decay_time)
+        .def_readwrite("nbaseline",     &GaussianShaper::nbaseline)
+        .def_readwrite("baseline_mode", &GaussianShaper::baseline_mode)
+        .def("__getstate__", [](const GaussianShaper &g) {
+            return py::make_tuple(g.peaktime, g.order, g.dt, g.decay_time, g.nbaseline, g.baseline_mode);
+        })
+        .def("__setstate__", [](GaussianShaper &shaper, py::tuple t) {
+            if (t.size() != 6)
+                throw std::runtime_error("Invalid state!");
+            new (&shaper) GaussianShaper(t[0].cast<double>(),t[1].cast<int>(),t[2].cast<double>(),t[3].cast<double>(),
+                                         t[4].cast<int>(),t[5].cast<BaselineMode>());
+        });
+
+    // the trapezoid over a continuous stream, fed chunk by chunk. The
+    // state is the stream itself, so it is not pickled
+    py::class_<StreamingTrapezoid>(m, "StreamingTrapezoid")
+        .def(py::init<int, int, size_t, float>(),
+             py::arg("ptime"), py::arg("flat") = 1000,
+             py::arg("window") = 50000, py::arg("sample_period") = 4)
+        // returns the energies of the windows completed by this chunk
+        .def("push", [](StreamingTrapezoid &s,
+                        py::array_t<int16_t, py::array::c_style | py::array::forcecast> samples) {
+            if (samples.ndim() != 1)
+                throw std::runtime_error("Samples have to be given as 1D array!");
+            std::vector<float> energies;
+            const int16_t* data = samples.data();
+            size_t nsamples     = samples.shape(0);
+            {
+                py::gil_scoped_release release;
+                s.push(data, nsamples, energies);
+            }
+            return py::array_t<float>(energies.size(), energies.data());
+        }, py::arg("samples"))
+        .def("flush", [](StreamingTrapezoid &s) {
+            std::vector<float> energies;
+            s.flush(energies);
+            return py::array_t<float>(energies.size(), energies.data());
+        })
+        .def("reset", &StreamingTrapezoid::reset)
+        .def("get_nsamples", &StreamingTrapezoid::get_nsamples)
+        .def_readonly("ptime",         &StreamingTrapezoid::ptime)
+        .def_readonly("flat",          &StreamingTrapezoid::flat)
+        .def_readonly("window",        &StreamingTrapezoid::window)
+        .def_readonly("sample_period", &StreamingTrapezoid::sample_period);
+
+    // software trigger for stored waveforms
+    py::enum_<TriggerMode>(m, "TriggerMode")
+        .value("LeadingEdge", TriggerMode::LeadingEdge)
+        .value("FastFilter",  TriggerMode::FastFilter)
+        .value("CFD",         TriggerMode::CFD)
+        .export_values();
+
+    py::class_<TriggerFinder>(m, "TriggerFinder")
+        .def(py::init<TriggerMode, float, int, float, int, int, float, BaselineMode>(),
+             py::arg("mode") = TriggerMode::FastFilter, py::arg("threshold") = 50,
+             py::arg("rc") = 100, py::arg("cfd_fraction") = 0.5, py::arg("cfd_delay") = 100,
+             py::arg("nbaseline") = 1000, py::arg("sample_period") = 4,
+             py::arg("baseline_mode") = BaselineMode::Mean)
+        .def("find_trigger", [](const TriggerFinder &t,
+                                py::array_t<int16_t, py::array::c_style | py::array::forcecast> waveform) {
+            if (waveform.ndim() != 1)
+                throw std::runtime_error("The waveform has to be given as 1D array!");
+            return t.find_trigger(waveform.data(), waveform.shape(0));
+        }, py::arg("waveform"))
+        // the first trigger of every row of a 2D array (nwaveforms x recordlength),
+        // recordlength for waveforms without trigger
+        .def("find_triggers", &shape_batch_<TriggerFinder, uint32_t, &TriggerFinder::find_triggers>,
+             py::arg("waveforms"), py::arg("nthreads") = 0)
+        .def_readwrite("mode",          &TriggerFinder::mode)
+        .def_readwrite("threshold",     &TriggerFinder::threshold)
+        .def_readwrite("rc",            &TriggerFinder::rc)
+        .def_readwrite("cfd_fraction",  &TriggerFinder::cfd_fraction)
+        .def_readwrite("cfd_delay",     &TriggerFinder::cfd_delay)
+        .def_readwrite("nbaseline",     &TriggerFinder::nbaseline)
+        .def_readwrite("sample_period", &TriggerFinder::sample_period)
+        .def_readwrite("baseline_mode", &TriggerFinder::baseline_mode)
+        .def("__getstate__", [](const TriggerFinder &t) {
+            return py::make_tuple(t.mode, t.threshold, t.rc, t.cfd_fraction, t.cfd_delay,
+                                  t.nbaseline, t.sample_period, t.baseline_mode);
+        })
+        .def("__setstate__", [](TriggerFinder &finder, py::tuple t) {
+            if (t.size() != 8)
+                throw std::runtime_error("Invalid state!");
+            new (&finder) TriggerFinder(t[0].cast<TriggerMode>(),t[1].cast<float>(),t[2].cast<int>(),
+                                        t[3].cast<float>(),t[4].cast<int>(),t[5].cast<int>(),
+                                        t[6].cast<float>(),t[7].cast<BaselineMode>());
+        });
+
+    // pulse shape features, as numpy structured array
+    PYBIND11_NUMPY_DTYPE(PulseFeatures_t, baseline, amplitude, trigger, peak, rise_time, tot, tail_total);
+
+    py::class_<PulseFeatureExtractor>(m, "PulseFeatureExtractor")
+        .def(py::init<float, int, int, float, BaselineMode>(),
+             py::arg("threshold") = 50, py::arg("tail_delay") = 200,
+             py::arg("nbaseline") = 1000, py::arg("sample_period") = 4,
+             py::arg("baseline_mode") = BaselineMode::Mean)
+        // returns one record per row of a 2D array (nwaveforms x recordlength) with
+        // the fields baseline, amplitude, trigger, peak, rise_time, tot, tail_total
+        .def("extract", &shape_batch_<PulseFeatureExtractor, PulseFeatures_t, &PulseFeatureExtractor::extract_batch>,
+             py::arg("waveforms"), py::arg("nthreads") = 0)
+        .def_readwrite("threshold",     &PulseFeatureExtractor::threshold)
+        .def_readwrite("tail_delay",    &PulseFeatureExtractor::tail_delay)
+        .def_readwrite("nbaseline",     &PulseFeatureExtractor::nbaseline)
+        .def_readwrite("sample_period", &PulseFeatureExtractor::sample_period)
+        .def_readwrite("baseline_mode", &PulseFeatureExtractor::baseline_mode)
+        .def("__getstate__", [](const PulseFeatureExtractor &p) {
+            return py::make_tuple(p.threshold, p.tail_delay, p.nbaseline, p.sample_period, p.baseline_mode);
+        })
+        .def("__setstate__", [](PulseFeatureExtractor &extractor, py::tuple t) {
+            if (t.size() != 5)
+                throw std::runtime_error("Invalid state!");
+            new (&extractor) PulseFeatureExtractor(t[0].cast<float>(),t[1].cast<int>(),t[2].cast<int>(),
+                                                   t[3].cast<float>(),t[4].cast<BaselineMode>());
+        });
+
+    // noise of the trapezoid over a grid of peaking times
+    py::class_<ENCScanner>(m, "ENCScanner")
+        .def(py::init<std::vector<int>, int, size_t, float>(),
+             py::arg("ptimes"), py::arg("flat") = 1000,
+             py::arg("nbaseline") = 0, py::arg("sample_period") = 4)
+        // returns the rms of the trapezoid in adc counts for every peaking time,
+        // from the baseline segments of a 2D array (nwaveforms x recordlength)
+        .def("scan", [](const ENCScanner &e,
+                        py::array_t<int16_t, py::array::c_style | py::array::forcecast> waveforms,
+                        int nthreads) {
+            if (waveforms.ndim() != 2)
+                throw std::runtime_error("Waveforms have to be given as 2D array (nwaveforms x recordlength)!");
+            size_t nwaveforms = waveforms.shape(0);
+            size_t nsamples   = waveforms.shape(1);
+            py::array_t<float> noise(e.ptimes.size());
+            const int16_t* data = waveforms.data();
+            float* out          = noise.mutable_data();
+            {
+                py::gil_scoped_release release;
+                e.scan(data, nwaveforms, nsamples, out, nthreads);
+            }
+            return noise;
+        }, py::arg("waveforms"), py::arg("nthreads") = 0)
+        .def("best_ptime", [](const ENCScanner &e, py::array_t<float, py::array::c_style | py::array::forcecast> noise) {
+            if ((noise.ndim() != 1) || ((size_t)noise.shape(0) != e.ptimes.size()))
+                throw std::runtime_error("Need one noise value per peaking time!");
+            return e.best_ptime(noise.data());
+        }, py::arg("noise"))
+        .def_readonly("ptimes",         &ENCScanner::ptimes)
+        .def_readonly("flat",           &ENCScanner::flat)
+        .def_readwrite("nbaseline",     &ENCScanner::nbaseline)
+        .def_readonly("sample_period",  &ENCScanner::sample_period)
+        .def("__getstate__", [](const ENCScanner &e) {
+            return py::make_tuple(e.ptimes, e.flat, e.nbaseline, e.sample_period);
+        })
+        .def("__setstate__", [](ENCScanner &scanner, py::tuple t) {
+            if (t.size() != 4)
+                throw std::runtime_error("Invalid state!");
+            new (&scanner) ENCScanner(t[0].cast<std::vector<int>>(),t[1].cast<int>(),
+                                      t[2].cast<size_t>(),t[3].cast<float>());
+        });
+
+    // all shapers and peaking times over cache sized tiles of waveforms
+    py::enum_<ShaperKind>(m, "ShaperKind")
+        .value("Trapezoid", ShaperKind::Trapezoid)
+        .value("Gaussian",  ShaperKind::Gaussian)
+        .export_values();
+
+    py::class_<ShaperSetting>(m, "ShaperSetting")
+        .def(py::init([](ShaperKind kind, int ptime, int param) {
+            return ShaperSetting{kind, ptime, param};
+        }), py::arg("kind"), py::arg("ptime"), py::arg("param"))
+        .def_readwrite("kind",  &ShaperSetting::kind)
+        .def_readwrite("ptime", &ShaperSetting::ptime)
+        .def_readwrite("param", &ShaperSetting::param)
+        .def("__getstate__", [](const ShaperSetting &s) {
+            return py::make_tuple(s.kind, s.ptime, s.param);
+        })
+        .def("__setstate__", [](ShaperSetting &setting, py::tuple t) {
             if (t.size() != 3)
                 throw std::runtime_error("Invalid state!");
-            new (&trap) TrapezoidalFilter(t[0].cast<int>(),t[1].cast<int>(),t[2].cast<int>());
+            new (&setting) ShaperSetting{t[0].cast<ShaperKind>(),t[1].cast<int>(),t[2].cast<int>()};
         });
 
+    PYBIND11_NUMPY_DTYPE(TileStats_t, waveform, nwaveforms, setting, nsettings, worker, stolen, seconds, msamples_per_s);
+
+    py::class_<TileScheduler>(m, "TileScheduler")
+        .def(py::init<std::vector<ShaperSetting>, size_t, size_t, float, double, int>(),
+             py::arg("settings"), py::arg("cache_bytes") = 1 << 20,
+             py::arg("settings_per_tile") = 0, py::arg("sample_period") = 4,
+             py::arg("decay_time") = 80000, py::arg("nbaseline") = 1000)
+        // returns the energies (nwaveforms x nsettings) and the statistics of
+        // every tile as structured array
+        .def("run", [](const TileScheduler &t,
+                       py::array_t<int16_t, py::array::c_style | py::array::forcecast> waveforms,
+                       int nthreads) {
+            if (waveforms.ndim() != 2)
+                throw std::runtime_error("Waveforms have to be given as 2D array (nwaveforms x recordlength)!");
+            size_t nwaveforms = waveforms.shape(0);
+            size_t nsamples   = waveforms.shape(1);
+            py::array_t<float> energies({nwaveforms, t.settings.size()});
+            const int16_t* data = waveforms.data();
+            float* out          = energies.mutable_data();
+            std::vector<TileStats_t> stats;
+            {
+                py::gil_scoped_release release;
+                t.run(data, nwaveforms, nsamples, out, stats, nthreads);
+            }
+            py::array_t<TileStats_t> tiles(stats.size());
+            if (!stats.empty())
+                std::memcpy(tiles.mutable_data(), stats.data(), stats.size()*sizeof(TileStats_t));
+            return py::make_tuple(energies, tiles);
+        }, py::arg("waveforms"), py::arg("nthreads") = 0)
+        .def_readonly("settings",          &TileScheduler::settings)
+        .def_readonly("cache_bytes",       &TileScheduler::cache_bytes)
+        .def_readonly("settings_per_tile", &TileScheduler::settings_per_tile)
+        .def_readonly("sample_period",     &TileScheduler::sample_period)
+        .def_readonly("decay_time",        &TileScheduler::decay_time)
+        .def_readonly("nbaseline",         &TileScheduler::nbaseline)
+        .def("__getstate__", [](const TileScheduler &t) {
+            return py::make_tuple(t.settings, t.cache_bytes, t.settings_per_tile,
+                                  t.sample_period, t.decay_time, t.nbaseline);
+        })
+        .def("__setstate__", [](TileScheduler &scheduler, py::tuple t) {
+            if (t.size() != 6)
+                throw std::runtime_error("Invalid state!");
+            new (&scheduler) TileScheduler(t[0].cast<std::vector<ShaperSetting>>(),t[1].cast<size_t>(),
+                                           t[2].cast<size_t>(),t[3].cast<float>(),t[4].cast<double>(),
+                                           t[5].cast<int>());
+        });
+
+    // averaged noise spectrum of the baselines, accumulated over
+    // any number of blocks. It is an accumulator, so it is not pickled
+    py::class_<NoisePSD>(m, "NoisePSD")
+        .def(py::init<size_t, size_t, float>(),
+             py::arg("nfft") = 1024, py::arg("noverlap") = 512, py::arg("sample_period") = 4)
+        // add the first nbaseline samples of every row of a 2D array
+        // (nwaveforms x recordlength), 0 for the whole waveforms
+        .def("add", [](NoisePSD &p,
+                       py::array_t<int16_t, py::array::c_style | py::array::forcecast> waveforms,
+                       size_t nbaseline, int nthreads) {
+            if (waveforms.ndim() != 2)
+                throw std::runtime_error("Waveforms have to be given as 2D array (nwaveforms x recordlength)!");
+            size_t nwaveforms = waveforms.shape(0);
+            size_t nsamples   = waveforms.shape(1);
+            const int16_t* data = waveforms.data();
+            {
+                py::gil_scoped_release release;
+                p.add(data, nwaveforms, nsamples, nbaseline, nthreads);
+            }
+        }, py::arg("waveforms"), py::arg("nbaseline") = 0, py::arg("nthreads") = 0)
+        // the one-sided density in adc counts^2/Hz
+        .def("get_psd", [](const NoisePSD &p) {
+            std::vector<double> psd = p.get_psd();
+            return py::array_t<double>(psd.size(), psd.data());
+        })
+        .def("get_frequencies", [](const NoisePSD &p) {
+            std::vector<double> frequencies = p.get_frequencies();
+            return py::array_t<double>(frequencies.size(), frequencies.data());
+        })
+        .def("get_nsegments", &NoisePSD::get_nsegments)
+        .def("reset", &NoisePSD::reset)
+        .def_readonly("nfft",          &NoisePSD::nfft)
+        .def_readonly("noverlap",      &NoisePSD::noverlap)
+        .def_readonly("sample_period", &NoisePSD::sample_period);
+
 
 
 };
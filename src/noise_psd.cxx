@@ -0,0 +1,183 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+#include <string>
+
+#include "noise_psd.h"
+#include "parallel_for.h"
+
+/*********************************************************************/
+
+NoisePSD::NoisePSD(size_t nfft, size_t noverlap, float sample_period) :
+                                                     nfft(nfft),
+                                                     noverlap(noverlap),
+                                                     sample_period(sample_period) {
+  if ((nfft < 4) || (nfft & (nfft - 1)))
+    throw std::runtime_error("The segment length has to be a power of 2 (at least 4)!");
+  if (noverlap >= nfft)
+    throw std::runtime_error("The overlap has to be shorter than the segment!");
+  if (sample_period <= 0)
+    throw std::runtime_error("The sample period has to be positive!");
+
+  // periodic hann window, as scipy.signal.get_window('hann', nfft)
+  window_.resize(nfft);
+  for (size_t n=0; n<nfft; n++)
+    {window_[n] = 0.5 - 0.5*std::cos(2*M_PI*n/nfft);}
+  twiddles_.resize(nfft/2);
+  for (size_t k=0; k<nfft/2; k++)
+    {twiddles_[k] = std::polar(1., -2*M_PI*k/nfft);}
+  size_t nbits = 0;
+  while (((size_t)1 << nbits) < nfft)
+    {nbits++;}
+  bitreverse_.resize(nfft);
+  for (size_t n=0; n<nfft; n++)
+    {
+      uint32_t r = 0;
+      for (size_t b=0; b<nbits; b++)
+        {r |= ((n >> b) & 1) << (nbits - 1 - b);}
+      bitreverse_[n] = r;
+    }
+  reset();
+};
+
+/*********************************************************************/
+
+void NoisePSD::add(const int16_t* data, size_t nwaveforms, size_t nsamples, size_t nbaseline,
+                   int nthreads) {
+  size_t nsegment = (nbaseline > 0) ? std::min(nbaseline, nsamples) : nsamples;
+  if (nsegment < nfft)
+    throw std::runtime_error("The baseline (" + std::to_string(nsegment) + " samples) is shorter than one fft segment ("
+                             + std::to_string(nfft) + " samples), use a shorter segment or a longer baseline!");
+  // the segment starts within one waveform
+  size_t step = nfft - noverlap;
+  std::vector<size_t> starts;
+  for (size_t s=0; s + nfft <= nsegment; s+=step)
+    {starts.push_back(s);}
+
+  parallel_for(nwaveforms, nthreads, [&](size_t begin, size_t end) {
+    std::vector<complex_t> z(nfft);
+    std::vector<double> sum(nfft/2 + 1, 0);
+    for (size_t k=begin; k<end; k++)
+      {
+        const int16_t* waveform = data + k*nsamples;
+        // two segments per transform
+        size_t i = 0;
+        for (; i + 1 < starts.size(); i+=2)
+          {add_segments_(waveform + starts[i], waveform + starts[i+1], z, sum);}
+        if (i < starts.size())
+          {add_segments_(waveform + starts[i], nullptr, z, sum);}
+      }
+    std::lock_guard<std::mutex> lock(mutex_);
+    for (size_t f=0; f<sum.size(); f++)
+      {sum_[f] += sum[f];}
+    nsegments_ += (end - begin)*starts.size();
+  });
+};
+
+/*********************************************************************/
+
+std::vector<double> NoisePSD::get_psd() const {
+  std::vector<double> psd(nfft/2 + 1, 0);
+  if (nsegments_ == 0) return psd;
+  // density scaling, everything except dc and nyquist
+  // appears twice in the two-sided spectrum
+  double fs     = 1e9/sample_period;
+  double wsum2(0);
+  for (auto w : window_)
+    {wsum2 += w*w;}
+  double scale  = 1/(fs*wsum2*nsegments_);
+  for (size_t f=0; f<psd.size(); f++)
+    {
+      double factor = ((f == 0) || (f == nfft/2)) ? 1 : 2;
+      psd[f] = factor*scale*sum_[f];
+    }
+  return psd;
+};
+
+/*********************************************************************/
+
+std::vector<double> NoisePSD::get_frequencies() const {
+  std::vector<double> frequencies(nfft/2 + 1);
+  double df = 1e9/(sample_period*nfft);
+  for (size_t f=0; f<frequencies.size(); f++)
+    {frequencies[f] = f*df;}
+  return frequencies;
+};
+
+/*********************************************************************/
+
+uint64_t NoisePSD::get_nsegments() const {
+  return nsegments_;
+};
+
+/*********************************************************************/
+
+void NoisePSD::reset() {
+  sum_.assign(nfft/2 + 1, 0);
+  nsegments_ = 0;
+};
+
+/*********************************************************************/
+
+void NoisePSD::fft_(std::vector<complex_t> &z) const {
+  for (size_t n=0; n<nfft; n++)
+    {
+      if (n < bitreverse_[n])
+        {std::swap(z[n], z[bitreverse_[n]]);}
+    }
+  for (size_t len=2; len<=nfft; len<<=1)
+    {
+      size_t half   = len/2;
+      size_t stride = nfft/len;
+      for (size_t i=0; i<nfft; i+=len)
+        {
+          for (size_t j=0; j<half; j++)
+            {
+              // written out, std::complex multiplication checks
+              // for inf and nan and is not inlined
+              complex_t u = z[i+j];
+              complex_t x = z[i+j+half];
+              complex_t w = twiddles_[j*stride];
+              complex_t v(x.real()*w.real() - x.imag()*w.imag(),
+                          x.real()*w.imag() + x.imag()*w.real());
+              z[i+j]      = u + v;
+              z[i+j+half] = u - v;
+            }
+        }
+    }
+};
+
+/*********************************************************************/
+
+void NoisePSD::add_segments_(const int16_t* a, const int16_t* b, std::vector<complex_t> &z,
+                             std::vector<double> &sum) const {
+  double mean_a(0), mean_b(0);
+  for (size_t n=0; n<nfft; n++)
+    {mean_a += a[n];}
+  mean_a /= nfft;
+  if (b)
+    {
+      for (size_t n=0; n<nfft; n++)
+        {mean_b += b[n];}
+      mean_b /= nfft;
+    }
+  for (size_t n=0; n<nfft; n++)
+    {
+      double im = b ? (b[n] - mean_b)*window_[n] : 0;
+      z[n] = complex_t((a[n] - mean_a)*window_[n], im);
+    }
+  fft_(z);
+
+  // the spectra of the real and the imaginary part are the even
+  // and the odd part of the transform: A = (Z(k) + Z*(N-k))/2,
+  // B = (Z(k) - Z*(N-k))/2i
+  for (size_t k=0; k<=nfft/2; k++)
+    {
+      complex_t zk = z[k];
+      complex_t zm = std::conj(z[(nfft - k) % nfft]);
+      sum[k] += std::norm(0.5*(zk + zm));
+      if (b)
+        {sum[k] += std::norm(0.5*(zk - zm));}
+    }
+};
+
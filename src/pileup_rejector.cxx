@@ -0,0 +1,147 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include "pileup_rejector.h"
+#include "parallel_for.h"
+
+/*********************************************************************/
+
+PileupRejector::PileupRejector(int ptime, int flat, int fast_ptime, int fast_flat, float threshold,
+                               float sample_period) :
+                                                     ptime(ptime),
+                                                     flat(flat),
+                                                     fast_ptime(fast_ptime),
+                                                     fast_flat(fast_flat),
+                                                     threshold(threshold),
+                                                     sample_period(sample_period) {
+  if (sample_period <= 0)
+    throw std::runtime_error("The sample period has to be positive!");
+  if ((std::lround(ptime/sample_period) < 1) || (std::lround(fast_ptime/sample_period) < 1))
+    throw std::runtime_error("The peaking times have to be at least one sample!");
+  if ((flat < 0) || (fast_flat < 0))
+    throw std::runtime_error("The flat tops can not be negative!");
+  if (threshold <= 0)
+    throw std::runtime_error("The trigger threshold has to be positive!");
+};
+
+/*********************************************************************/
+
+size_t PileupRejector::find_pulses(const int16_t* waveform, size_t nsamples, std::vector<Pulse_t> &pulses,
+                                   bool reject) const {
+  std::vector<uint32_t> triggers;
+  std::vector<float> trapezoid;
+  uint32_t npileup(0);
+  return find_pulses_(waveform, nsamples, pulses, reject, triggers, trapezoid, npileup);
+};
+
+/*********************************************************************/
+
+void PileupRejector::find_pulses_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                                       std::vector<Pulse_t> &pulses, uint32_t* npulses, uint32_t* npileup,
+                                       bool reject, int nthreads) const {
+  // every chunk of waveforms collects its pulses separately,
+  // so that they can be put together in order afterwards
+  const size_t chunk = 16;
+  std::vector<std::vector<Pulse_t>> chunk_pulses((nwaveforms + chunk - 1)/chunk);
+  parallel_for(nwaveforms, nthreads, [&](size_t begin, size_t end) {
+    std::vector<uint32_t> triggers;
+    std::vector<float> trapezoid;
+    std::vector<Pulse_t> &found = chunk_pulses[begin/chunk];
+    for (size_t k=begin; k<end; k++)
+      {
+        size_t first = found.size();
+        npulses[k] = find_pulses_(data + k*nsamples, nsamples, found, reject,
+                                  triggers, trapezoid, npileup[k]);
+        for (size_t p=first; p<found.size(); p++)
+          {found[p].waveform = k;}
+      }
+  }, chunk);
+
+  size_t ntotal = pulses.size();
+  for (auto const &found : chunk_pulses)
+    {ntotal += found.size();}
+  pulses.reserve(ntotal);
+  for (auto const &found : chunk_pulses)
+    {pulses.insert(pulses.end(), found.begin(), found.end());}
+};
+
+/*********************************************************************/
+
+size_t PileupRejector::find_pulses_(const int16_t* waveform, size_t nsamples, std::vector<Pulse_t> &pulses,
+                                    bool reject, std::vector<uint32_t> &triggers, std::vector<float> &trapezoid,
+                                    uint32_t &npileup) const {
+  npileup = 0;
+  triggers.clear();
+  size_t nramp = std::lround(ptime/sample_period);
+  size_t nflat = std::lround(flat/sample_period);
+  size_t ntot  = 2*nramp + nflat;
+  size_t nfast_ramp = std::lround(fast_ptime/sample_period);
+  size_t nfast_flat = std::lround(fast_flat/sample_period);
+  size_t nfast_tot  = 2*nfast_ramp + nfast_flat;
+  if (nsamples <= nfast_tot) return 0;
+
+  // the fast filter, a trigger is a crossing of the threshold
+  // from below. The filter has to fall below the threshold
+  // again before the next trigger
+  int64_t fast_threshold = (int64_t)(threshold*nfast_ramp);
+  int64_t fast_sum(0);
+  for (size_t j=0; j<nfast_ramp; j++)
+    {fast_sum += waveform[nfast_tot-j] - waveform[nfast_tot-j-nfast_ramp-nfast_flat];}
+  bool armed = (fast_sum < fast_threshold);
+  for (size_t i=nfast_tot+1; i<nsamples; i++)
+    {
+      fast_sum += waveform[i] - waveform[i-nfast_ramp]
+                - waveform[i-nfast_ramp-nfast_flat] + waveform[i-nfast_tot];
+      if (armed && (fast_sum >= fast_threshold))
+        {
+          triggers.push_back(i);
+          armed = false;
+        }
+      else if (fast_sum < fast_threshold)
+        {armed = true;}
+    }
+  if (triggers.empty()) return 0;
+
+  // the energy filter over the whole record, see TrapezoidalFilter
+  trapezoid.assign(nsamples, 0);
+  if (nsamples > ntot)
+    {
+      int64_t amp_sum(0);
+      for (size_t j=0; j<nramp; j++)
+        {amp_sum += waveform[ntot-j] - waveform[ntot-j-nramp-nflat];}
+      float norm = 1/(float)nramp;
+      trapezoid[ntot] = amp_sum*norm;
+      for (size_t i=ntot+1; i<nsamples; i++)
+        {
+          amp_sum += waveform[i] - waveform[i-nramp]
+                   - waveform[i-nramp-nflat] + waveform[i-ntot];
+          trapezoid[i] = amp_sum*norm;
+        }
+    }
+
+  // after the trigger the trapezoid rises for nramp samples and 
+  // stays flat for nflat, before it only falls. It looks at the
+  // samples back to ntot before the trigger, so any other trigger
+  // from there on until the end of the flat top spoils the energy
+  for (size_t t=0; t<triggers.size(); t++)
+    {
+      size_t trigger = triggers[t];
+      size_t end     = trigger + nramp + nflat;
+      Pulse_t pulse  = {0, (uint32_t)trigger, 0, 0};
+      if ((trigger <= nramp) || (end > nsamples))
+        {pulse.flags |= (uint8_t)PulseFlag::Truncated;}
+      if (((t > 0) && (triggers[t-1] + ntot > trigger)) ||
+          ((t + 1 < triggers.size()) && (triggers[t+1] < end)))
+        {
+          pulse.flags |= (uint8_t)PulseFlag::Pileup;
+          npileup++;
+        }
+      for (size_t i=std::max(trigger, ntot); i<std::min(end, nsamples); i++)
+        {pulse.energy = std::max(pulse.energy, trapezoid[i]);}
+      if (reject && pulse.flags) continue;
+      pulses.push_back(pulse);
+    }
+  return triggers.size();
+};
+
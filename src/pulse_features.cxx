@@ -0,0 +1,98 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include "pulse_features.h"
+#include "parallel_for.h"
+
+/*********************************************************************/
+
+// the time (in samples) where the leading edge last crosses level
+// before the maximum, linearly interpolated
+static float crossing_before_(const int16_t* waveform, size_t peak, float level) {
+  size_t i = peak;
+  while ((i > 0) && (waveform[i-1] >= level))
+    {i--;}
+  if (i == 0) return 0;
+  float x0 = waveform[i-1];
+  float x1 = waveform[i];
+  return (i - 1) + (level - x0)/(x1 - x0);
+};
+
+/*********************************************************************/
+
+PulseFeatureExtractor::PulseFeatureExtractor(float threshold, int tail_delay, int nbaseline,
+                                             float sample_period, BaselineMode baseline_mode) :
+                                                     threshold(threshold),
+                                                     tail_delay(tail_delay),
+                                                     nbaseline(nbaseline),
+                                                     sample_period(sample_period),
+                                                     baseline_mode(baseline_mode) {
+  if (sample_period <= 0)
+    throw std::runtime_error("The sample period has to be positive!");
+  if (threshold <= 0)
+    throw std::runtime_error("The threshold has to be positive!");
+  if (tail_delay < 0)
+    throw std::runtime_error("The tail delay can not be negative!");
+  if (nbaseline < 0)
+    throw std::runtime_error("The number of baseline samples can not be negative!");
+};
+
+/*********************************************************************/
+
+PulseFeatures_t PulseFeatureExtractor::extract(const int16_t* waveform, size_t nsamples) const {
+  PulseFeatures_t f = {};
+  f.baseline = estimate_baseline(waveform, nsamples, nbaseline, baseline_mode);
+  f.trigger  = nsamples;
+  if (nsamples == 0) return f;
+
+  // everything is done on the raw integer samples, the baseline
+  // is only taken out at the end. The pulse is the first one that
+  // crosses the threshold, its maximum is searched for until the
+  // waveform falls below the threshold again, so that a larger
+  // pulse piled up later does not take over the peak. The searches
+  // stop early, the sums are branch free loops which the compiler
+  // vectorizes. The waveform stays in the cache for all of them
+  float level_f = std::ceil(f.baseline + threshold);
+  if (level_f > INT16_MAX) return f;
+  int16_t level = (int16_t)std::max<float>(level_f, INT16_MIN);
+  size_t trigger = std::find_if(waveform, waveform + nsamples,
+                                [&](int16_t x) {return x >= level;}) - waveform;
+  if (trigger == nsamples) return f;
+  size_t tot_end = std::find_if(waveform + trigger, waveform + nsamples,
+                                [&](int16_t x) {return x < level;}) - waveform;
+  size_t peak    = std::max_element(waveform + trigger, waveform + tot_end) - waveform;
+  int16_t xmax   = waveform[peak];
+  size_t tail_start = std::min(peak + (size_t)(tail_delay/sample_period), nsamples);
+  int64_t sum_head(0), sum_tail(0);
+  for (size_t i=trigger; i<tail_start; i++)
+    {sum_head += waveform[i];}
+  for (size_t i=tail_start; i<nsamples; i++)
+    {sum_tail += waveform[i];}
+
+  f.amplitude = xmax - f.baseline;
+  f.trigger   = trigger;
+  f.peak      = peak;
+  f.tot       = (tot_end - trigger)*sample_period;
+
+  float t10   = crossing_before_(waveform, peak, f.baseline + 0.1f*f.amplitude);
+  float t90   = crossing_before_(waveform, peak, f.baseline + 0.9f*f.amplitude);
+  f.rise_time = (t90 - t10)*sample_period;
+
+  double tail  = sum_tail - (double)f.baseline*(nsamples - tail_start);
+  double total = sum_head + tail - (double)f.baseline*(tail_start - trigger);
+  if (total > 0)
+    {f.tail_total = tail/total;}
+  return f;
+};
+
+/*********************************************************************/
+
+void PulseFeatureExtractor::extract_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                                          PulseFeatures_t* features, int nthreads) const {
+  parallel_for(nwaveforms, nthreads, [&](size_t begin, size_t end) {
+    for (size_t k=begin; k<end; k++)
+      {features[k] = extract(data + k*nsamples, nsamples);}
+  });
+};
+
@@ -0,0 +1,138 @@
+#include <stdexcept>
+#include <string>
+#include <iostream>
+
+#include "readout_buffer_pool.hh"
+
+/***************************************************************/
+
+ReadoutBufferPool::ReadoutBufferPool() : handle_(-1),
+                                         buffer_size_(0)
+{
+}
+
+/***************************************************************/
+
+ReadoutBufferPool::~ReadoutBufferPool()
+{
+    // if another thread still holds one of the buffers, they are
+    // rather leaked than freed under it
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.size() != buffers_.size())
+        {
+            std::cerr << "Leaking the readout buffers, " << buffers_.size() - free_.size()
+                      << " of them are still in use!" << std::endl;
+            return;
+        }
+    free_buffers_();
+}
+
+/***************************************************************/
+
+void ReadoutBufferPool::allocate(int handle, size_t nbuffers)
+{
+    if (nbuffers == 0) throw std::runtime_error("The pool needs at least one buffer!");
+    std::lock_guard<std::mutex> lock(mutex_);
+    check_unused_();
+    free_buffers_();
+    handle_ = handle;
+    // the addresses have to stay, reserve first
+    buffers_.reserve(nbuffers);
+    free_.reserve(nbuffers);
+    CAEN_DGTZ_ErrorCode err;
+    uint32_t size;
+    // if one of the mallocs fails, the pool is left empty
+    auto check = [this](CAEN_DGTZ_ErrorCode err, std::string const &what) {
+        if (err == 0) return;
+        free_buffers_();
+        throw std::runtime_error("Error while allocating " + what + ", err code " + std::to_string(err));
+    };
+    for (size_t k=0; k<nbuffers; k++)
+        {
+            buffers_.push_back(ReadoutBuffer_t());
+            ReadoutBuffer_t &b = buffers_.back();
+            err = CAEN_DGTZ_MallocReadoutBuffer(handle_, &b.buffer, &buffer_size_);
+            check(err, "readout buffer");
+            err = CAEN_DGTZ_MallocDPPEvents(handle_, (void**)(b.events), &size);
+            check(err, "DPP event buffer");
+            err = CAEN_DGTZ_MallocDPPWaveforms(handle_, (void**)(&b.waveform), &size);
+            check(err, "DPP waveform buffer");
+            free_.push_back(&b);
+        }
+}
+
+/***************************************************************/
+
+void ReadoutBufferPool::free()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    check_unused_();
+    free_buffers_();
+}
+
+/***************************************************************/
+
+void ReadoutBufferPool::check_unused_() const
+{
+    if (free_.size() != buffers_.size())
+        throw std::runtime_error("Can not free the readout buffers while " + std::to_string(buffers_.size() - free_.size())
+                                 + " of them are in use!");
+}
+
+/***************************************************************/
+
+void ReadoutBufferPool::free_buffers_()
+{
+    // a buffer which failed to allocate has its pointers still zeroed
+    for (auto &b : buffers_)
+        {
+            if (b.buffer)      CAEN_DGTZ_FreeReadoutBuffer(&b.buffer);
+            if (b.events[0])   CAEN_DGTZ_FreeDPPEvents(handle_, (void**)(b.events));
+            if (b.waveform)    CAEN_DGTZ_FreeDPPWaveforms(handle_, b.waveform);
+        }
+    buffers_.clear();
+    free_.clear();
+    buffer_size_ = 0;
+}
+
+/***************************************************************/
+
+ReadoutBuffer_t* ReadoutBufferPool::acquire()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (free_.empty()) return nullptr;
+    ReadoutBuffer_t* b = free_.back();
+    free_.pop_back();
+    return b;
+}
+
+/***************************************************************/
+
+void ReadoutBufferPool::release(ReadoutBuffer_t* buffer)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    free_.push_back(buffer);
+}
+
+/***************************************************************/
+
+size_t ReadoutBufferPool::size() const
+{
+    return buffers_.size();
+}
+
+/***************************************************************/
+
+size_t ReadoutBufferPool::get_nfree()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return free_.size();
+}
+
+/***************************************************************/
+
+uint32_t ReadoutBufferPool::get_buffer_size() const
+{
+    return buffer_size_;
+}
+
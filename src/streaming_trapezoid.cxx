@@ -0,0 +1,114 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include "streaming_trapezoid.h"
+
+/*********************************************************************/
+
+StreamingTrapezoid::StreamingTrapezoid(int ptime, int flat, size_t window, float sample_period) :
+                                                     ptime(ptime),
+                                                     flat(flat),
+                                                     window(window),
+                                                     sample_period(sample_period) {
+  if (sample_period <= 0)
+    throw std::runtime_error("The sample period has to be positive!");
+  if ((ptime < sample_period) || (flat < 0))
+    throw std::runtime_error("The peaking time has to be at least one sample, the flat top can not be negative!");
+  if (window == 0)
+    throw std::runtime_error("The window has to be at least one sample!");
+  nramp_ = std::lround(ptime/sample_period);
+  nflat_ = std::lround(flat/sample_period);
+  ntot_  = 2*nramp_ + nflat_;
+  history_.resize(ntot_);
+  reset();
+};
+
+/*********************************************************************/
+
+size_t StreamingTrapezoid::push(const int16_t* samples, size_t nsamples, std::vector<float> &energies) {
+  // the recursion of TrapezoidalFilter, started with zeros before
+  // the first sample. The trapezoid is complete from the sample
+  // ntot_ of the stream on, only from there the maximum is taken
+  const size_t nrampnflat = nramp_ + nflat_;
+  const size_t nhead = std::min(nsamples, ntot_);
+  const size_t first_valid = (nseen_ >= ntot_) ? 0 : ntot_ - nseen_;
+  const float norm = 1/(float)nramp_;
+  // the first ntot_ samples of the chunk reach back into the history
+  auto at = [&](size_t k, size_t d) -> int64_t {
+    return (k >= d) ? samples[k-d] : history_[ntot_ + k - d];
+  };
+
+  size_t nemitted(0);
+  size_t k(0);
+  while (k < nsamples)
+    {
+      size_t end = std::min(nsamples, k + (window - nwindow_));
+      nwindow_ += end - k;
+      for (; k<std::min(end, nhead); k++)
+        {
+          amp_sum_ += samples[k] - at(k, nramp_) - at(k, nrampnflat) + at(k, ntot_);
+          if (k >= first_valid)
+            {max_sum_ = std::max(max_sum_, amp_sum_);}
+        }
+      // first_valid is at most ntot_, so no check is needed here
+      int64_t amp_sum = amp_sum_;
+      int64_t max_sum = max_sum_;
+      for (; k<end; k++)
+        {
+          amp_sum += samples[k] - samples[k-nramp_]
+                   - samples[k-nrampnflat] + samples[k-ntot_];
+          max_sum  = std::max(max_sum, amp_sum);
+        }
+      amp_sum_ = amp_sum;
+      max_sum_ = max_sum;
+      if (nwindow_ == window)
+        {
+          energies.push_back(max_sum_*norm);
+          nemitted++;
+          max_sum_ = 0;
+          nwindow_ = 0;
+        }
+    }
+  nseen_ += nsamples;
+
+  // keep the last ntot_ samples for the next chunk
+  if (nsamples >= ntot_)
+    {std::copy(samples + nsamples - ntot_, samples + nsamples, history_.begin());}
+  else
+    {
+      std::copy(history_.begin() + nsamples, history_.end(), history_.begin());
+      std::copy(samples, samples + nsamples, history_.end() - nsamples);
+    }
+  return nemitted;
+};
+
+/*********************************************************************/
+
+size_t StreamingTrapezoid::flush(std::vector<float> &energies) {
+  size_t nemitted(0);
+  if (nwindow_ > 0)
+    {
+      energies.push_back(max_sum_*(1/(float)nramp_));
+      nemitted++;
+    }
+  reset();
+  return nemitted;
+};
+
+/*********************************************************************/
+
+void StreamingTrapezoid::reset() {
+  std::fill(history_.begin(), history_.end(), 0);
+  amp_sum_ = 0;
+  max_sum_ = 0;
+  nseen_   = 0;
+  nwindow_ = 0;
+};
+
+/*********************************************************************/
+
+uint64_t StreamingTrapezoid::get_nsamples() const {
+  return nseen_;
+};
+
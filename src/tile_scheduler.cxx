@@ -0,0 +1,101 @@
+#include <stdexcept>
+#include <algorithm>
+#include <chrono>
+
+#include "tile_scheduler.h"
+#include "parallel_for.h"
+
+/*********************************************************************/
+
+TileScheduler::TileScheduler(std::vector<ShaperSetting> const &settings, size_t cache_bytes,
+                             size_t settings_per_tile, float sample_period,
+                             double decay_time, int nbaseline) :
+                                                     settings(settings),
+                                                     cache_bytes(cache_bytes),
+                                                     settings_per_tile(settings_per_tile),
+                                                     sample_period(sample_period),
+                                                     decay_time(decay_time),
+                                                     nbaseline(nbaseline) {
+  if (settings.empty())
+    throw std::runtime_error("Need at least one shaper setting!");
+  // the shapers check their parameters themselves
+  for (auto const &s : settings)
+    {
+      switch (s.kind)
+        {
+          case ShaperKind::Trapezoid:
+            shaper_index_.push_back(trapezoids_.size());
+            trapezoids_.emplace_back(s.ptime, s.param, 50000, sample_period);
+            break;
+          case ShaperKind::Gaussian:
+            shaper_index_.push_back(gaussians_.size());
+            gaussians_.emplace_back(s.ptime, s.param, sample_period, decay_time, nbaseline);
+            break;
+          default:
+            throw std::runtime_error("Unknown shaper kind!");
+        }
+    }
+};
+
+/*********************************************************************/
+
+void TileScheduler::run(const int16_t* data, size_t nwaveforms, size_t nsamples, float* energies,
+                        std::vector<TileStats_t> &stats, int nthreads) const {
+  stats.clear();
+  if ((nwaveforms == 0) || (nsamples == 0)) return;
+
+  // the tiles, waveform blocks are the outer loop so that the
+  // tiles of one block are neighbours
+  size_t nsettings = settings.size();
+  size_t wf_bytes  = nsamples*sizeof(int16_t);
+  size_t wf_tile   = std::max<size_t>(8, cache_bytes/wf_bytes);
+  size_t set_tile  = (settings_per_tile > 0) ? std::min(settings_per_tile, nsettings) : nsettings;
+  for (size_t w=0; w<nwaveforms; w+=wf_tile)
+    {
+      for (size_t s=0; s<nsettings; s+=set_tile)
+        {
+          TileStats_t tile = {};
+          tile.waveform   = w;
+          tile.nwaveforms = std::min(wf_tile, nwaveforms - w);
+          tile.setting    = s;
+          tile.nsettings  = std::min(set_tile, nsettings - s);
+          stats.push_back(tile);
+        }
+    }
+
+  // the shapers write the energies of a tile contiguously, there
+  // is one buffer per thread for that
+  int nworkers = (nthreads > 0) ? nthreads : std::max(1u, std::thread::hardware_concurrency());
+  std::vector<std::vector<float>> buffers(nworkers);
+  work_stealing_for(stats.size(), nworkers, [&](size_t t, int worker, bool stolen) {
+    TileStats_t &tile = stats[t];
+    tile.worker = worker;
+    tile.stolen = stolen;
+    auto start = std::chrono::steady_clock::now();
+    run_tile_(data, nsamples, nsettings, tile, energies, buffers[worker]);
+    auto stop  = std::chrono::steady_clock::now();
+    tile.seconds = std::chrono::duration<double>(stop - start).count();
+    double nshaped = (double)tile.nwaveforms*tile.nsettings*nsamples;
+    tile.msamples_per_s = (tile.seconds > 0) ? 1e-6*nshaped/tile.seconds : 0;
+  });
+};
+
+/*********************************************************************/
+
+void TileScheduler::run_tile_(const int16_t* data, size_t nsamples, size_t nsettings_total,
+                              TileStats_t &tile, float* energies, std::vector<float> &buffer) const {
+  const int16_t* block = data + (size_t)tile.waveform*nsamples;
+  buffer.resize(tile.nwaveforms);
+  for (size_t s=tile.setting; s<tile.setting + tile.nsettings; s++)
+    {
+      // single threaded, the pool is already running on all cores
+      size_t index = shaper_index_[s];
+      if (settings[s].kind == ShaperKind::Trapezoid)
+        {trapezoids_[index].shape_batch(block, tile.nwaveforms, nsamples, buffer.data(), 1);}
+      else
+        {gaussians_[index].shape_batch(block, tile.nwaveforms, nsamples, buffer.data(), 1);}
+      for (size_t k=0; k<tile.nwaveforms; k++)
+        {energies[(tile.waveform + k)*nsettings_total + s] = buffer[k];}
+    }
+};
+
@@ -0,0 +1,223 @@
+#include <algorithm>
+#include <string>
+
+#include "trapezoidal_kernels.h"
+
+#if (defined(__x86_64__) || defined(__i386__)) && defined(__GNUC__)
+#define DACTYLOS_X86_DISPATCH 1
+#include <immintrin.h>
+#endif
+
+/***************************************************************/
+
+// the window sum for the first output sample
+// i = 2*nramp + nflat, the recursion starts from here
+template<typename T>
+static inline int64_t initial_window_sum_(const T* waveform, int nramp, int nflat)
+{
+  int ntot = 2*nramp + nflat;
+  int nrampnflat = nramp + nflat;
+  int64_t amp_sum(0);
+  for (int j=0; j<nramp; j++)
+    {
+      amp_sum += (int64_t)waveform[ntot-j] - waveform[ntot-j-nrampnflat];
+    }
+  return amp_sum;
+}
+
+/***************************************************************/
+
+// continue the recursion from output sample 'start' on, where
+// amp_sum holds the window sum of sample start - 1
+template<typename T>
+static inline int64_t scalar_tail_(const T* waveform, size_t start, size_t nsamples,
+                                   int nramp, int nflat, int64_t amp_sum, int64_t max_sum)
+{
+  int nrampnflat = nramp + nflat;
+  for (size_t i=start; i<nsamples; i++)
+    {
+      amp_sum += (int64_t)waveform[i] - waveform[i-nramp]
+               - waveform[i-nrampnflat] + waveform[i-nrampnflat-nramp];
+      if (amp_sum > max_sum) max_sum = amp_sum;
+    }
+  return max_sum;
+}
+
+/***************************************************************/
+
+int64_t trapezoid_max_scalar(const int16_t* waveform, size_t nsamples, int nramp, int nflat)
+{
+  size_t ntot = 2*nramp + nflat;
+  if ((nramp <= 0) || (nsamples <= ntot)) return 0;
+  // every step adds the sample entering and removes the one
+  // leaving each of the two ramps (Jordanov)
+  int64_t amp_sum = initial_window_sum_(waveform, nramp, nflat);
+  return scalar_tail_(waveform, ntot + 1, nsamples, nramp, nflat,
+                      amp_sum, std::max<int64_t>(amp_sum, 0));
+}
+
+/***************************************************************/
+
+int64_t trapezoid_max_int32(const int32_t* waveform, size_t nsamples, int nramp, int nflat)
+{
+  size_t ntot = 2*nramp + nflat;
+  if ((nramp <= 0) || (nsamples <= ntot)) return 0;
+  int64_t amp_sum = initial_window_sum_(waveform, nramp, nflat);
+  return scalar_tail_(waveform, ntot + 1, nsamples, nramp, nflat,
+                      amp_sum, std::max<int64_t>(amp_sum, 0));
+}
+
+/***************************************************************/
+
+void cumulative_sum(const int16_t* waveform, size_t nsamples, uint32_t* cumsum)
+{
+  uint32_t sum = 0;
+  cumsum[0] = 0;
+  for (size_t k=0; k<nsamples; k++)
+    {
+      sum += (uint32_t)(int32_t)waveform[k];
+      cumsum[k+1] = sum;
+    }
+}
+
+/***************************************************************/
+
+#ifdef DACTYLOS_X86_DISPATCH
+
+__attribute__((target("avx2")))
+int64_t trapezoid_max_avx2(const int16_t* waveform, size_t nsamples, int nramp, int nflat)
+{
+  size_t ntot = 2*nramp + nflat;
+  if ((nramp <= 0) || (nsamples <= ntot)) return 0;
+  if (nramp > MAX_SIMD_NRAMP) return trapezoid_max_scalar(waveform, nsamples, nramp, nflat);
+  size_t nrampnflat = nramp + nflat;
+
+  int64_t amp_sum = initial_window_sum_(waveform, nramp, nflat);
+  int64_t max_sum = std::max<int64_t>(amp_sum, 0);
+
+  __m256i vmax    = _mm256_set1_epi32((int32_t)max_sum);
+  __m256i vsum    = _mm256_set1_epi32((int32_t)amp_sum);
+  __m256i last    = _mm256_set1_epi32(7);
+  size_t i = ntot + 1;
+  for (; i + 8 <= nsamples; i += 8)
+    {
+      __m256i a = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(waveform + i)));
+      __m256i b = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(waveform + i - nramp)));
+      __m256i c = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(waveform + i - nrampnflat)));
+      __m256i d = _mm256_cvtepi16_epi32(_mm_loadu_si128((const __m128i*)(waveform + i - ntot)));
+      // the increments of the running sum
+      __m256i x = _mm256_sub_epi32(_mm256_sub_epi32(a, b), _mm256_sub_epi32(c, d));
+      // inclusive prefix sum within the two 128 bit lanes...
+      x = _mm256_add_epi32(x, _mm256_slli_si256(x, 4));
+      x = _mm256_add_epi32(x, _mm256_slli_si256(x, 8));
+      // ... and carry the total of the lower lane into the upper one
+      __m256i carry = _mm256_shuffle_epi32(x, _MM_SHUFFLE(3,3,3,3));
+      carry = _mm256_permute2x128_si256(carry, carry, 0x08);
+      x = _mm256_add_epi32(x, carry);
+      vsum = _mm256_add_epi32(x, vsum);
+      vmax = _mm256_max_epi32(vmax, vsum);
+      vsum = _mm256_permutevar8x32_epi32(vsum, last);
+    }
+  alignas(32) int32_t lanes[8];
+  _mm256_store_si256((__m256i*)lanes, vmax);
+  for (int k=0; k<8; k++)
+    {max_sum = std::max<int64_t>(max_sum, lanes[k]);}
+  amp_sum = _mm256_cvtsi256_si32(vsum);
+  return scalar_tail_(waveform, i, nsamples, nramp, nflat, amp_sum, max_sum);
+}
+
+/***************************************************************/
+
+__attribute__((target("avx512f")))
+int64_t trapezoid_max_avx512(const int16_t* waveform, size_t nsamples, int nramp, int nflat)
+{
+  size_t ntot = 2*nramp + nflat;
+  if ((nramp <= 0) || (nsamples <= ntot)) return 0;
+  if (nramp > MAX_SIMD_NRAMP) return trapezoid_max_scalar(waveform, nsamples, nramp, nflat);
+  size_t nrampnflat = nramp + nflat;
+
+  int64_t amp_sum = initial_window_sum_(waveform, nramp, nflat);
+  int64_t max_sum = std::max<int64_t>(amp_sum, 0);
+
+  // the maskz forms with all lanes set are the same instructions, but
+  // do not start from an undefined vector as the plain intrinsics of
+  // gcc do, which -Wmaybe-uninitialized reports. vmax starts below any
+  // window sum, max_sum already holds the first one
+  const __mmask16 all = 0xFFFF;
+  __m512i vmax    = _mm512_set1_epi32(INT32_MIN);
+  __m512i vsum    = _mm512_set1_epi32((int32_t)amp_sum);
+  __m512i last    = _mm512_set1_epi32(15);
+  __m512i zero    = _mm512_setzero_si512();
+  size_t i = ntot + 1;
+  for (; i + 16 <= nsamples; i += 16)
+    {
+      __m512i a = _mm512_maskz_cvtepi16_epi32(all, _mm256_loadu_si256((const __m256i*)(waveform + i)));
+      __m512i b = _mm512_maskz_cvtepi16_epi32(all, _mm256_loadu_si256((const __m256i*)(waveform + i - nramp)));
+      __m512i c = _mm512_maskz_cvtepi16_epi32(all, _mm256_loadu_si256((const __m256i*)(waveform + i - nrampnflat)));
+      __m512i d = _mm512_maskz_cvtepi16_epi32(all, _mm256_loadu_si256((const __m256i*)(waveform + i - ntot)));
+      __m512i x = _mm512_sub_epi32(_mm512_sub_epi32(a, b), _mm512_sub_epi32(c, d));
+      // inclusive prefix sum over all 16 lanes, shifting in zeros
+      x = _mm512_add_epi32(x, _mm512_maskz_alignr_epi32(all, x, zero, 15));
+      x = _mm512_add_epi32(x, _mm512_maskz_alignr_epi32(all, x, zero, 14));
+      x = _mm512_add_epi32(x, _mm512_maskz_alignr_epi32(all, x, zero, 12));
+      x = _mm512_add_epi32(x, _mm512_maskz_alignr_epi32(all, x, zero, 8));
+      vsum = _mm512_add_epi32(x, vsum);
+      vmax = _mm512_maskz_max_epi32(all, vmax, vsum);
+      vsum = _mm512_maskz_permutexvar_epi32(all, last, vsum);
+    }
+  alignas(64) int32_t lanes[16];
+  _mm512_store_si512((void*)lanes, vmax);
+  for (int k=0; k<16; k++)
+    {max_sum = std::max<int64_t>(max_sum, lanes[k]);}
+  amp_sum = _mm512_cvtsi512_si32(vsum);
+  return scalar_tail_(waveform, i, nsamples, nramp, nflat, amp_sum, max_sum);
+}
+
+#else
+
+// no runtime dispatch available on this platform/compiler
+int64_t trapezoid_max_avx2(const int16_t* waveform, size_t nsamples, int nramp, int nflat)
+{
+  return trapezoid_max_scalar(waveform, nsamples, nramp, nflat);
+}
+
+int64_t trapezoid_max_avx512(const int16_t* waveform, size_t nsamples, int nramp, int nflat)
+{
+  return trapezoid_max_scalar(waveform, nsamples, nramp, nflat);
+}
+
+#endif
+
+/***************************************************************/
+
+static const char* detect_kernel_name_()
+{
+#ifdef DACTYLOS_X86_DISPATCH
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f")) return "avx512";
+  if (__builtin_cpu_supports("avx2"))    return "avx2";
+#endif
+  return "scalar";
+}
+
+/***************************************************************/
+
+const char* get_trapezoid_kernel_name()
+{
+  static const char* name = detect_kernel_name_();
+  return name;
+}
+
+/***************************************************************/
+
+trapezoid_kernel_t select_trapezoid_kernel()
+{
+  static const trapezoid_kernel_t kernel = [](){
+    std::string name = get_trapezoid_kernel_name();
+    if (name == "avx512") return &trapezoid_max_avx512;
+    if (name == "avx2")   return &trapezoid_max_avx2;
+    return &trapezoid_max_scalar;
+  }();
+  return kernel;
+}
+
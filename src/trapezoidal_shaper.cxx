@@ -1,37 +1,412 @@
 #include <iostream>
+#include <stdexcept>
+#include <cmath>
+#include <algorithm>
 
 #include "trapezoidal_shaper.h"
+#include "parallel_for.h"
+#include "trapezoidal_kernels.h"
 
-TrapezoidalFilter::TrapezoidalFilter(int ptime, int flat, int recordlength) : 
+TrapezoidalFilter::TrapezoidalFilter(int ptime, int flat, int recordlength,
+                                     float sample_period, int decimation) :
                                                      ptime(ptime),
                                                      flat(flat),
-                                                     recordlength(recordlength) {
+                                                     recordlength(recordlength),
+                                                     sample_period(sample_period),
+                                                     decimation(decimation) {
+  if (sample_period <= 0)
+    throw std::runtime_error("The sample period has to be positive!");
+  // the block sums have to fit into 32 bit
+  if ((decimation < 1) || (decimation > 65536))
+    throw std::runtime_error("Decimation has to be in [1, 65536]!");
 };
 
 
-uint32_t TrapezoidalFilter::shape_it(const std::vector<int16_t> &waveform) const {
-    
-  int32_t  sum_rise(0), sum_down(0);
-  float amp_filter(0), energy(0);
+float TrapezoidalFilter::shape_it(const std::vector<int16_t> &waveform) const {
+  std::vector<int32_t> buffer;
+  return shape_(waveform.data(), waveform.size(), buffer);
+};
 
-  int16_t nramp = ptime/4; //4ns per sample
-  int16_t nflat = flat/4;
-  int16_t ntot = 2*nramp+nflat;
-  int16_t nrampnflat = nramp + nflat;
 
-  for(int i=ntot;i<waveform.size();i++) {
-    amp_filter = 0;
-    for(int j=0;j<nramp;j++)
-      {
-        amp_filter += ((float)(waveform[i-j] - waveform[i-j-nrampnflat]))*(1/(float)nramp);
-        //sum_down -= waveform[i-j-nrampnflat]*(1/nramp);
-      }
-    if(amp_filter > energy)
+void TrapezoidalFilter::shape_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                                    float* energies, int nthreads) const {
+  parallel_for(nwaveforms, nthreads, [&](size_t begin, size_t end) {
+    std::vector<int32_t> buffer;
+    for (size_t k=begin; k<end; k++)
+      {energies[k] = shape_(data + k*nsamples, nsamples, buffer);}
+  });
+};
+
+
+std::string TrapezoidalFilter::get_kernel_name() {
+  return get_trapezoid_kernel_name();
+};
+
+
+void TrapezoidalFilter::shape_traces(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                                     float* traces, size_t decimation, int nthreads) const {
+  if (decimation == 0)
+    throw std::runtime_error("Decimation has to be at least 1!");
+  size_t ntrace = get_trace_length(nsamples, decimation);
+  size_t nramp  = std::max(to_samples_(ptime, 1), 0);
+  size_t nflat  = std::max(to_samples_(flat, 1), 0);
+  size_t ntot   = 2*nramp + nflat;
+  float norm    = (nramp > 0) ? 1/(float)nramp : 0;
+  parallel_for(nwaveforms, nthreads, [&](size_t begin, size_t end) {
+    for (size_t k=begin; k<end; k++)
       {
-        energy = amp_filter;  //energy calculation, need to be improved
+        const int16_t* waveform = data + k*nsamples;
+        float* trace = traces + k*ntrace;
+        std::fill(trace, trace + ntrace, 0.f);
+        if ((nramp == 0) || (nsamples <= ntot)) continue;
+        // the same recursion as the kernels, see trapezoidal_kernels.h
+        int64_t amp_sum(0);
+        for (size_t j=0; j<nramp; j++)
+          {amp_sum += waveform[ntot-j] - waveform[ntot-j-nramp-nflat];}
+        for (size_t i=ntot; i<nsamples; i++)
+          {
+            if (i > ntot)
+              {
+                amp_sum += waveform[i] - waveform[i-nramp]
+                         - waveform[i-nramp-nflat] + waveform[i-ntot];
+              }
+            if (i % decimation == 0)
+              {trace[i/decimation] = amp_sum*norm;}
+          }
       }
-  }
-  return energy;
+  });
+};
+
+
+size_t TrapezoidalFilter::get_trace_length(size_t nsamples, size_t decimation) {
+  if (decimation == 0) return 0;
+  return (nsamples + decimation - 1)/decimation;
+};
+
+
+int TrapezoidalFilter::to_samples_(int time, int decimation) const {
+  return std::lround(time/(sample_period*decimation));
+};
+
+
+float TrapezoidalFilter::shape_(const int16_t* waveform, size_t nsamples, std::vector<int32_t> &buffer) const {
+
+  int nramp = to_samples_(ptime, decimation);
+  int nflat = to_samples_(flat, decimation);
+  if (nramp <= 0) return 0;
+  if (decimation > 1)
+    {
+      // sum up blocks of samples, an incomplete last block is
+      // dropped. The sums are the averages times decimation, 
+      // which is taken out in the normalization
+      size_t nblocks = nsamples/decimation;
+      buffer.resize(nblocks);
+      for (size_t b=0; b<nblocks; b++)
+        {
+          int32_t sum(0);
+          const int16_t* block = waveform + b*decimation;
+          for (int k=0; k<decimation; k++)
+            {sum += block[k];}
+          buffer[b] = sum;
+        }
+      return trapezoid_max_int32(buffer.data(), nblocks, nramp, nflat)*(1/((float)nramp*decimation));
+    }
+  // the vectorized kernel for this cpu, see trapezoidal_kernels.h
+  static const trapezoid_kernel_t kernel = select_trapezoid_kernel();
+  return kernel(waveform, nsamples, nramp, nflat)*(1/(float)nramp);
+};
+
+
+
+PoleZeroTrapezoidalFilter::PoleZeroTrapezoidalFilter(int rise, int flat, int decay, int flat_top_delay, int peak_mean,
+                                                     int nbaseline, BaselineMode baseline_mode, float sample_period) :
+                                                     rise(rise),
+                                                     flat(flat),
+                                                     decay(decay),
+                                                     flat_top_delay(flat_top_delay),
+                                                     peak_mean(peak_mean),
+                                                     nbaseline(nbaseline),
+                                                     baseline_mode(baseline_mode),
+                                                     sample_period(sample_period) {
+  if (sample_period <= 0)
+    throw std::runtime_error("The sample period has to be positive!");
+  if ((peak_mean < 0) || (peak_mean > 3))
+    throw std::runtime_error("peak_mean has to be in [0,3] (1, 4, 16 or 64 samples)!");
+  if (decay <= 0)
+    throw std::runtime_error("The decay time has to be positive!");
+  if (nbaseline < 0)
+    throw std::runtime_error("The number of baseline samples can not be negative!");
+};
+
+
+float PoleZeroTrapezoidalFilter::shape_it(const std::vector<int16_t> &waveform) const {
+  std::vector<float> trapezoid(waveform.size());
+  return shape_(waveform.data(), waveform.size(), trapezoid.data());
+};
+
+
+void PoleZeroTrapezoidalFilter::shape_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                                            float* energies, int nthreads) const {
+  parallel_for(nwaveforms, nthreads, [&](size_t begin, size_t end) {
+    std::vector<float> trapezoid(nsamples);
+    for (size_t k=begin; k<end; k++)
+      {energies[k] = shape_(data + k*nsamples, nsamples, trapezoid.data());}
+  });
+};
+
+
+float PoleZeroTrapezoidalFilter::shape_(const int16_t* waveform, size_t nsamples, float* trapezoid) const {
+
+  size_t k = std::lround(rise/sample_period);
+  size_t l = k + std::lround(flat/sample_period);
+  if ((k == 0) || (nsamples <= k + l)) return 0;
+  // the pole-zero correction turns exp(-t/tau) into a step of height M + 1
+  double tau_samples = decay/sample_period;
+  double M = 1./(std::exp(1./tau_samples) - 1.);
+  double norm = 1./(k*(M + 1.));
+
+  // the pole-zero correction would see the start of the record
+  // as a step which does not decay. Samples before the start of
+  // the record are thus taken to be at the baseline
+  double baseline = estimate_baseline(waveform, nsamples, nbaseline, baseline_mode);
+  auto v = [&](size_t n, size_t delay) -> double {
+    return (n >= delay) ? waveform[n - delay] : baseline;
+  };
+
+  // d(n) = v(n) - v(n-k) - v(n-l) + v(n-k-l)
+  // p(n) = p(n-1) + d(n)
+  // r(n) = p(n) + M*d(n)
+  // s(n) = s(n-1) + r(n)
+  double d(0), p(0), s(0);
+  float max_trapezoid(0);
+  size_t max_index(0);
+  for (size_t n=0; n<nsamples; n++)
+    {
+      d  = v(n, 0) - v(n, k) - v(n, l) + v(n, k + l);
+      p += d;
+      s += p + M*d;
+      trapezoid[n] = s*norm;
+      if (trapezoid[n] > max_trapezoid)
+        {
+          max_trapezoid = trapezoid[n];
+          max_index     = n;
+        }
+    }
+  if (max_trapezoid <= 0) return 0;
+
+  // the trapezoid rises linearly over k samples, so it crosses
+  // half of its height k/2 samples before the flat top starts
+  size_t half_index = max_index;
+  while ((half_index > 0) && (trapezoid[half_index - 1] >= 0.5*max_trapezoid))
+    {half_index--;}
+  size_t first = half_index + k/2 + std::lround(flat_top_delay/sample_period);
+  size_t npeak = (size_t)1 << (2*peak_mean);
+  if (first >= nsamples) return max_trapezoid;
+  size_t last  = std::min(first + npeak, nsamples);
+  double energy(0);
+  for (size_t n=first; n<last; n++)
+    {energy += trapezoid[n];}
+  return energy/(last - first);
+};
+
+
+
+const int FixedPointTrapezoidalFilter::MAXNBITS;
+
+FixedPointTrapezoidalFilter::FixedPointTrapezoidalFilter(int rise, int flat, int decay, int flat_top_delay, int peak_mean,
+                                                         int nsamples_baseline, float energy_normalization,
+                                                         float sample_period) :
+                                                     rise(rise),
+                                                     flat(flat),
+                                                     decay(decay),
+                                                     flat_top_delay(flat_top_delay),
+                                                     peak_mean(peak_mean),
+                                                     nsamples_baseline(nsamples_baseline),
+                                                     energy_normalization(energy_normalization),
+                                                     sample_period(sample_period) {
+  if (sample_period <= 0)
+    throw std::runtime_error("The sample period has to be positive!");
+  if ((peak_mean < 0) || (peak_mean > 3))
+    throw std::runtime_error("peak_mean has to be in [0,3] (1, 4, 16 or 64 samples)!");
+  if ((nsamples_baseline < 0) || (nsamples_baseline > 6))
+    throw std::runtime_error("nsamples_baseline has to be in [0,6] (0, 16, 64 ... 16384 samples)!");
+  if (std::lround(decay/sample_period) < 1)
+    throw std::runtime_error("The decay time has to be at least one sample!");
+  if (energy_normalization < 0)
+    throw std::runtime_error("The energy normalization can not be negative!");
+};
+
+
+uint16_t FixedPointTrapezoidalFilter::shape_it(const std::vector<int16_t> &waveform) const {
+  std::vector<int64_t> trapezoid(waveform.size());
+  return shape_(waveform.data(), waveform.size(), trapezoid.data());
+};
+
+
+void FixedPointTrapezoidalFilter::shape_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                                              uint16_t* energies, int nthreads) const {
+  parallel_for(nwaveforms, nthreads, [&](size_t begin, size_t end) {
+    std::vector<int64_t> trapezoid(nsamples);
+    for (size_t k=begin; k<end; k++)
+      {energies[k] = shape_(data + k*nsamples, nsamples, trapezoid.data());}
+  });
+};
+
+
+uint16_t FixedPointTrapezoidalFilter::shape_(const int16_t* waveform, size_t nsamples, int64_t* trapezoid) const {
+
+  size_t k = std::lround(rise/sample_period);
+  size_t l = k + std::lround(flat/sample_period);
+  if ((k == 0) || (nsamples <= k + l)) return 0;
+  int64_t M = std::lround(decay/sample_period);
+
+  // trapezoid rescaling, the height of the trapezoid is A*k*M.
+  // The energy word has one bit more than the 14 bit adc, which
+  // is kept as fraction
+  int shf = 0;
+  while (((int64_t)1 << shf) < (int64_t)k*M)
+    {shf++;}
+  shf = std::max(shf - (MAXNBITS - 14), 0);
+  // the fine gain, a 16 bit fraction which makes up for the
+  // difference between k*M and 2^shf
+  int64_t fine_gain = std::llround(energy_normalization*65536.*((int64_t)1 << shf)/(double)(k*M));
+
+  // integer baseline, truncated like a shift would do
+  int64_t baseline(0);
+  if (nsamples_baseline > 0)
+    {
+      size_t nbl = std::min((size_t)1 << (2*nsamples_baseline + 2), nsamples);
+      for (size_t n=0; n<nbl; n++)
+        {baseline += waveform[n];}
+      baseline /= (int64_t)nbl;
+    }
+  auto v = [&](size_t n, size_t delay) -> int64_t {
+    return (n >= delay) ? waveform[n - delay] - baseline : 0;
+  };
+
+  // the same recursion as PoleZeroTrapezoidalFilter, with
+  // r(n) = p(n) + M*d(n) in integers
+  int64_t d(0), p(0), s(0);
+  int64_t max_trapezoid(0);
+  size_t max_index(0);
+  for (size_t n=0; n<nsamples; n++)
+    {
+      d  = v(n, 0) - v(n, k) - v(n, l) + v(n, k + l);
+      p += d;
+      s += p + M*d;
+      trapezoid[n] = s >> shf;
+      if (trapezoid[n] > max_trapezoid)
+        {
+          max_trapezoid = trapezoid[n];
+          max_index     = n;
+        }
+    }
+  if (max_trapezoid <= 0) return 0;
+
+  // energy sampling, see PoleZeroTrapezoidalFilter
+  size_t half_index = max_index;
+  while ((half_index > 0) && (2*trapezoid[half_index - 1] >= max_trapezoid))
+    {half_index--;}
+  size_t first = half_index + k/2 + std::lround(flat_top_delay/sample_period);
+  size_t npeak = (size_t)1 << (2*peak_mean);
+  int64_t peak(0);
+  if (first + npeak > nsamples)
+    {peak = max_trapezoid;}
+  else
+    {
+      for (size_t n=first; n<first+npeak; n++)
+        {peak += trapezoid[n];}
+      peak >>= 2*peak_mean;
+    }
+  if (peak <= 0) return 0;
+  int64_t energy = (peak*fine_gain) >> 16;
+  return (uint16_t)std::min<int64_t>(energy, ((int64_t)1 << MAXNBITS) - 1);
 };
 
 
+
+FlatTopTrapezoidalFilter::FlatTopTrapezoidalFilter(int ptime, int flat, int flat_top_delay, int peak_mean,
+                                                   float threshold, int fast_ptime, float sample_period) :
+                                                     ptime(ptime),
+                                                     flat(flat),
+                                                     flat_top_delay(flat_top_delay),
+                                                     peak_mean(peak_mean),
+                                                     threshold(threshold),
+                                                     fast_ptime(fast_ptime),
+                                                     sample_period(sample_period) {
+  if (sample_period <= 0)
+    throw std::runtime_error("The sample period has to be positive!");
+  if ((peak_mean < 0) || (peak_mean > 3))
+    throw std::runtime_error("peak_mean has to be in [0,3] (1, 4, 16 or 64 samples)!");
+  if ((std::lround(ptime/sample_period) < 1) || (std::lround(fast_ptime/sample_period) < 1))
+    throw std::runtime_error("The peaking times have to be at least one sample!");
+  if (threshold <= 0)
+    throw std::runtime_error("The trigger threshold has to be positive!");
+};
+
+
+float FlatTopTrapezoidalFilter::shape_it(const std::vector<int16_t> &waveform) const {
+  return shape_(waveform.data(), waveform.size());
+};
+
+
+void FlatTopTrapezoidalFilter::shape_batch(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                                           float* energies, int nthreads) const {
+  parallel_for(nwaveforms, nthreads, [&](size_t begin, size_t end) {
+    for (size_t k=begin; k<end; k++)
+      {energies[k] = shape_(data + k*nsamples, nsamples);}
+  });
+};
+
+
+size_t FlatTopTrapezoidalFilter::find_trigger(const int16_t* waveform, size_t nsamples) const {
+  // a trapezoid with fast_ptime rise and flat top, which stops
+  // at the first crossing of the threshold from below
+  size_t nramp = std::lround(fast_ptime/sample_period);
+  size_t ntot  = 3*nramp;
+  if (nsamples <= ntot) return nsamples;
+  int64_t fast_threshold = (int64_t)(threshold*nramp);
+  int64_t fast_sum(0);
+  for (size_t j=0; j<nramp; j++)
+    {fast_sum += waveform[ntot-j] - waveform[ntot-j-2*nramp];}
+  bool armed = (fast_sum < fast_threshold);
+  for (size_t i=ntot+1; i<nsamples; i++)
+    {
+      fast_sum += waveform[i] - waveform[i-nramp]
+                - waveform[i-2*nramp] + waveform[i-ntot];
+      if (fast_sum < fast_threshold)
+        {armed = true;}
+      else if (armed)
+        {return i;}
+    }
+  return nsamples;
+};
+
+
+float FlatTopTrapezoidalFilter::shape_(const int16_t* waveform, size_t nsamples) const {
+
+  size_t trigger = find_trigger(waveform, nsamples);
+  if (trigger >= nsamples) return 0;
+
+  // the flat top starts nramp samples after the trigger
+  size_t nramp = std::lround(ptime/sample_period);
+  size_t nflat = std::lround(flat/sample_period);
+  size_t ntot  = 2*nramp + nflat;
+  size_t first = trigger + nramp + std::lround(flat_top_delay/sample_period);
+  size_t npeak = (size_t)1 << (2*peak_mean);
+  if ((first < ntot) || (first + npeak > nsamples)) return 0;
+
+  // the window sum at the first sample of the flat top window,
+  // and from there on recursively
+  int64_t amp_sum(0);
+  for (size_t j=0; j<nramp; j++)
+    {amp_sum += waveform[first-j] - waveform[first-j-nramp-nflat];}
+  int64_t energy = amp_sum;
+  for (size_t i=first+1; i<first+npeak; i++)
+    {
+      amp_sum += waveform[i] - waveform[i-nramp]
+               - waveform[i-nramp-nflat] + waveform[i-ntot];
+      energy  += amp_sum;
+    }
+  return energy/((float)nramp*npeak);
+};
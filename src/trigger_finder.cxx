@@ -0,0 +1,175 @@
+#include <stdexcept>
+#include <algorithm>
+#include <cmath>
+
+#include "trigger_finder.h"
+#include "parallel_for.h"
+
+/*********************************************************************/
+
+// the first index in [begin, end) for which pred is true, end if
+// there is none. Whole blocks are tested first with a loop without
+// early exit, which the compiler can vectorize
+template<typename Pred>
+static inline size_t find_first_(size_t begin, size_t end, Pred pred) {
+  const size_t block = 64;
+  size_t i = begin;
+  for (; i + block <= end; i += block)
+    {
+      int any = 0;
+      for (size_t j=0; j<block; j++)
+        {any |= pred(i + j);}
+      if (any) break;
+    }
+  for (; i<end; i++)
+    {
+      if (pred(i)) return i;
+    }
+  return end;
+};
+
+/*********************************************************************/
+
+TriggerFinder::TriggerFinder(TriggerMode mode, float threshold, int rc, float cfd_fraction,
+                             int cfd_delay, int nbaseline, float sample_period,
+                             BaselineMode baseline_mode) :
+                                                     mode(mode),
+                                                     threshold(threshold),
+                                                     rc(rc),
+                                                     cfd_fraction(cfd_fraction),
+                                                     cfd_delay(cfd_delay),
+                                                     nbaseline(nbaseline),
+                                                     sample_period(sample_period),
+                                                     baseline_mode(baseline_mode) {
+  if (sample_period <= 0)
+    throw std::runtime_error("The sample period has to be positive!");
+  if (threshold <= 0)
+    throw std::runtime_error("The trigger threshold has to be positive!");
+  if ((rc < sample_period) || (cfd_delay < sample_period))
+    throw std::runtime_error("rc and the cfd delay have to be at least one sample!");
+  if ((cfd_fraction <= 0) || (cfd_fraction >= 1))
+    throw std::runtime_error("The cfd fraction has to be in (0, 1)!");
+  if (nbaseline < 0)
+    throw std::runtime_error("The number of baseline samples can not be negative!");
+};
+
+/*********************************************************************/
+
+size_t TriggerFinder::find_trigger(const int16_t* waveform, size_t nsamples) const {
+  std::vector<int32_t> buffer;
+  return find_trigger_(waveform, nsamples, buffer);
+};
+
+/*********************************************************************/
+
+void TriggerFinder::find_triggers(const int16_t* data, size_t nwaveforms, size_t nsamples,
+                                  uint32_t* triggers, int nthreads) const {
+  parallel_for(nwaveforms, nthreads, [&](size_t begin, size_t end) {
+    std::vector<int32_t> buffer;
+    for (size_t k=begin; k<end; k++)
+      {triggers[k] = find_trigger_(data + k*nsamples, nsamples, buffer);}
+  });
+};
+
+/*********************************************************************/
+
+size_t TriggerFinder::find_trigger_(const int16_t* waveform, size_t nsamples, std::vector<int32_t> &buffer) const {
+  switch (mode)
+    {
+      case TriggerMode::LeadingEdge:
+        return leading_edge_(waveform, nsamples, estimate_baseline(waveform, nsamples, nbaseline, baseline_mode));
+      case TriggerMode::FastFilter:
+        return fast_filter_(waveform, nsamples, buffer);
+      case TriggerMode::CFD:
+        return cfd_(waveform, nsamples, estimate_baseline(waveform, nsamples, nbaseline, baseline_mode));
+      default:
+        throw std::runtime_error("Unknown trigger mode!");
+    }
+};
+
+/*********************************************************************/
+
+size_t TriggerFinder::leading_edge_(const int16_t* waveform, size_t nsamples, float baseline) const {
+  // the samples are integers, so the comparison can be done
+  // against the rounded up level
+  float level_f = std::ceil(baseline + threshold);
+  if (level_f > INT16_MAX) return nsamples;
+  int16_t level = (int16_t)std::max<float>(level_f, INT16_MIN);
+  size_t armed = find_first_(0, nsamples, [&](size_t i) {return waveform[i] < level;});
+  return find_first_(armed, nsamples, [&](size_t i) {return waveform[i] >= level;});
+};
+
+/*********************************************************************/
+
+size_t TriggerFinder::cfd_(const int16_t* waveform, size_t nsamples, float baseline) const {
+  size_t armed = leading_edge_(waveform, nsamples, baseline);
+  if (armed >= nsamples) return nsamples;
+  // the zero crossing of f*(x[i] - b) - (x[i-d] - b) after the
+  // leading edge
+  size_t ndelay = (size_t)(cfd_delay/sample_period);
+  float f       = cfd_fraction;
+  float offset  = (1 - f)*baseline;
+  return find_first_(std::max(armed, ndelay), nsamples, [&](size_t i) {
+    return f*waveform[i] - waveform[i-ndelay] + offset <= 0;
+  });
+};
+
+/*********************************************************************/
+
+size_t TriggerFinder::fast_filter_(const int16_t* waveform, size_t nsamples, std::vector<int32_t> &buffer) const {
+  // RC-CR is a triangle, the trapezoid with nramp = k and no flat
+  // top. It is k times the average difference of two neighbouring
+  // windows, and the second difference (CR2) of it is
+  // D2(i) = S(i) - S(i-k)
+  size_t k = (size_t)(rc/sample_period);
+  if (nsamples < 3*k) return nsamples;
+  buffer.resize(nsamples);
+  int32_t* s = buffer.data();
+  int32_t amp_sum(0);
+  for (size_t j=0; j<k; j++)
+    {amp_sum += waveform[2*k-1-j] - waveform[k-1-j];}
+  s[2*k-1] = amp_sum;
+
+  // for a step of height A, D2 peaks at k*A
+  int64_t level_i = (int64_t)std::ceil(threshold*k);
+  int32_t level   = (int32_t)std::min<int64_t>(level_i, INT32_MAX);
+  auto below   = [&](size_t i) {return s[i] - s[i-k] < level;};
+  auto above   = [&](size_t i) {return s[i] - s[i-k] >= level;};
+  auto crossed = [&](size_t i) {return s[i] - s[i-k] <= 0;};
+
+  // the filter is only computed block by block until the zero
+  // crossing is found, which is usually long before the end of
+  // the record
+  const size_t block = 1024;
+  size_t computed = 2*k;
+  size_t i        = 3*k - 1;
+  int stage(0);
+  while (i < nsamples)
+    {
+      size_t end = std::min(nsamples, i + block);
+      for (; computed<end; computed++)
+        {
+          amp_sum += waveform[computed] - 2*waveform[computed-k] + waveform[computed-2*k];
+          s[computed] = amp_sum;
+        }
+      // armed -> above the threshold -> zero crossing
+      while (i < end)
+        {
+          if (stage == 0)
+            {i = find_first_(i, end, below);}
+          else if (stage == 1)
+            {i = find_first_(i, end, above);}
+          else
+            {i = find_first_(i, end, crossed);}
+          if (i == end) break;
+          if (stage == 2)
+            {
+              // the zero crossing is 3/2 k - 1 samples after the step
+              size_t delay = 3*k/2 - 1;
+              return (i > delay) ? i - delay : 0;
+            }
+          stage++;
+        }
+    }
+  return nsamples;
+};
@@ -0,0 +1,108 @@
+// Tests of the ReadoutBufferPool without a digitizer. The few
+// CAEN_DGTZ functions the pool calls are replaced by versions
+// which only count the allocated buffers, so this is not linked
+// against the CAEN library.
+
+#include <iostream>
+#include <cstdlib>
+#include <string>
+
+#include "readout_buffer_pool.hh"
+
+/***************************************************************/
+
+static int nallocated = 0;
+
+CAEN_DGTZ_ErrorCode CAENDGTZ_API CAEN_DGTZ_MallocReadoutBuffer(int, char **buffer, uint32_t *size)
+{
+    *buffer = (char*)std::malloc(1024);
+    *size   = 1024;
+    nallocated++;
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode CAENDGTZ_API CAEN_DGTZ_FreeReadoutBuffer(char **buffer)
+{
+    std::free(*buffer);
+    *buffer = nullptr;
+    nallocated--;
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode CAENDGTZ_API CAEN_DGTZ_MallocDPPEvents(int, void **events, uint32_t *allocatedSize)
+{
+    events[0]      = std::malloc(1024);
+    *allocatedSize = 1024;
+    nallocated++;
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode CAENDGTZ_API CAEN_DGTZ_FreeDPPEvents(int, void **events)
+{
+    std::free(events[0]);
+    events[0] = nullptr;
+    nallocated--;
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode CAENDGTZ_API CAEN_DGTZ_MallocDPPWaveforms(int, void **waveforms, uint32_t *allocatedSize)
+{
+    *waveforms     = std::malloc(1024);
+    *allocatedSize = 1024;
+    nallocated++;
+    return CAEN_DGTZ_Success;
+}
+
+CAEN_DGTZ_ErrorCode CAENDGTZ_API CAEN_DGTZ_FreeDPPWaveforms(int, void *waveforms)
+{
+    std::free(waveforms);
+    nallocated--;
+    return CAEN_DGTZ_Success;
+}
+
+/***************************************************************/
+
+static int nfailed = 0;
+
+static void check(bool ok, std::string const &what)
+{
+    std::cout << (ok ? "[ OK ] " : "[FAIL] ") << what << std::endl;
+    if (!ok) nfailed++;
+}
+
+/***************************************************************/
+
+int main()
+{
+    {
+        ReadoutBufferPool pool;
+        pool.allocate(0, 4);
+        check(nallocated == 12, "allocate gets 3 buffers per readout buffer");
+    }
+    check(nallocated == 0, "the destructor frees all buffers");
+
+    {
+        ReadoutBufferPool pool;
+        pool.allocate(0, 4);
+        ReadoutBuffer_t* block = pool.acquire();
+        bool thrown = false;
+        try
+            {pool.free();}
+        catch (std::exception const &)
+            {thrown = true;}
+        check(thrown, "free throws while a buffer is in use");
+        check(nallocated == 12, "a failed free keeps all buffers");
+        pool.release(block);
+        pool.free();
+        check(nallocated == 0, "free after the buffer is released");
+    }
+
+    {
+        ReadoutBufferPool pool;
+        pool.allocate(0, 4);
+        pool.acquire();
+    }
+    check(nallocated == 12, "the destructor leaks the buffers if one is in use");
+
+    return nfailed ? EXIT_FAILURE : EXIT_SUCCESS;
+}